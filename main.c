@@ -1,3 +1,6 @@
+#if __linux
+#define _GNU_SOURCE // nftw
+#endif
 #include "glad/glad.h"
 //#include <GL/freeglut_ext.h> // glutMainLoopEvent
 #ifdef __APPLE__
@@ -8,9 +11,11 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <stdio.h>
+#include <ctype.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include <curl/curl.h>
+#include <sqlite3.h>
 #include <search.h>
 #if defined(WIN32)
 #include <direct.h>
@@ -45,6 +50,9 @@ typedef CONDITION_VARIABLE cnd_t;
 #define cnd_signal(c) WakeConditionVariable(c)
 #define cnd_wait(c,m) SleepConditionVariableCS(c,m,INFINITE)
 #endif
+#define cas64(p,old,val) (InterlockedCompareExchange64((volatile LONGLONG*)(p), (LONGLONG)(val), (LONGLONG)(old)) == (LONGLONG)(old))
+#define process_id() ((int)GetCurrentProcessId())
+#define memory_barrier() MemoryBarrier()
 void print(const char* format, ...) {
 	char buf[256];
 	va_list argptr;
@@ -53,10 +61,19 @@ void print(const char* format, ...) {
 	va_end(argptr);
 	OutputDebugStringA(buf);
 }
+double time_ms() {
+	return (double)GetTickCount64();
+}
+void sleep_ms(int ms) {
+	Sleep(ms);
+}
 #elif __linux || __APPLE__
 #include <pthread.h>
 #include <unistd.h>
 #include <sys/syscall.h>
+#include <time.h>
+#include <ftw.h>
+#include <fcntl.h>
 #define Sleep(ms) usleep(ms)
 #define StartThread(start,arg) { pthread_t th; pthread_create(&th, 0, start, (void*)arg); }
 typedef pthread_mutex_t mtx_t;
@@ -74,12 +91,23 @@ typedef pthread_cond_t cnd_t;
 #define cnd_destroy(c) pthread_cond_destroy(c)
 #define cnd_signal(c) pthread_cond_signal(c)
 #define cnd_wait(c,m) pthread_cond_wait(c,m)
+#define cas64(p,old,val) __sync_bool_compare_and_swap(p, old, val)
+#define process_id() ((int)getpid())
+#define memory_barrier() __sync_synchronize()
 void print(const char* format, ...) {
 	va_list argptr;
 	va_start(argptr, format);
 	vfprintf(stderr, format, argptr);
 	va_end(argptr);
 }
+double time_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+void sleep_ms(int ms) {
+	usleep(ms * 1000);
+}
 #endif
 
 // Tile
@@ -93,6 +121,9 @@ typedef struct Tile {
 	float vtx[16];    // vertices
 	float blend;
 	char* filename;
+	void* body;       // downloaded bytes (Buf*) waiting for decode
+	double retry_at;  // failed to load, request again after this (ms)
+	int idle;         // filled while loaders were idle, not drawn yet
 	volatile int ref; // has effect volatile??
 } Tile;
 
@@ -105,6 +136,9 @@ void tile_init(Tile* t,int x,int y,int z){
 	t->texdata = 0;
 	t->blend = 0;
 	t->filename = 0;
+	t->body = 0;
+	t->retry_at = 0;
+	t->idle = 0;
 	t->ref = 1;
 }
 
@@ -138,6 +172,24 @@ int tile_quad(Tile* t) {
 	return xeven && yeven ? 0 : xeven ? 2 : yeven ? 1 : 3;
 }
 
+// unique tile key, never 0
+unsigned long long tile_key(int z, int x, int y) {
+	return 1ull << 63 | (unsigned long long)z << 58 | (unsigned long long)x << 29 | (unsigned long long)y;
+}
+
+void key_tile(unsigned long long key, Tile* t) {
+	tile_init(t, (int)(key >> 29 & 0x1fffffff), (int)(key & 0x1fffffff), (int)(key >> 58 & 31));
+}
+
+// stable hash of the tile key
+unsigned int tile_hash(const Tile* t) {
+	unsigned int h = (unsigned int)t->x * 73856093u ^ (unsigned int)t->y * 19349663u ^ (unsigned int)t->z * 83492791u;
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	return h;
+}
+
 int tile_make(Tile* t);
 int tile_make_tex(Tile* t);
 
@@ -228,6 +280,10 @@ int clamp(int n, int lower, int upper) {
 	return n < lower ? lower : n > upper ? upper : n;
 }
 
+double clampd(double n, double lower, double upper) {
+	return n < lower ? lower : n > upper ? upper : n;
+}
+
 // Queue
 typedef struct Node{
 	char* data;
@@ -293,6 +349,17 @@ void* queue_pop(Queue* q){
 	return 0;
 }
 
+// remove cur from a singly linked queue, prev is the node before it
+void* queue_unlink(Queue* q, Node* prev, Node* cur) {
+	void* ret = cur->data;
+	if(prev) prev->next = cur->next;
+	else q->first = cur->next;
+	if(q->last == cur) q->last = prev;
+	--q->count;
+	free(cur);
+	return ret;
+}
+
 void* queue_pop_s(Queue* q){
 	mtx_lock(&q->mtx);
 	if (q->count){
@@ -617,15 +684,258 @@ int exists(const char* name) {
 	return stat(name, &st) == 0;
 }
 
+// Bucket
+// token bucket rate limiter, rate in requests per second
+typedef struct Bucket {
+	double rate;   // 0 - unlimited
+	double burst;
+	double tokens;
+	double last;   // ms
+} Bucket;
+
+void bucket_init(Bucket* b, double rate, double burst) {
+	b->rate = rate;
+	b->burst = burst < 1 ? 1 : burst;
+	b->tokens = b->burst;
+	b->last = time_ms();
+}
+
+void bucket_fill(Bucket* b) {
+	double now = time_ms();
+	b->tokens += (now - b->last) * b->rate / 1000.0;
+	if(b->tokens > b->burst) b->tokens = b->burst;
+	b->last = now;
+}
+
+// ms until a token is there, 0 - now
+double bucket_wait(Bucket* b) {
+	if(b->rate <= 0) return 0;
+	bucket_fill(b);
+	if(b->tokens >= 1) return 0;
+	return (1 - b->tokens) * 1000.0 / b->rate;
+}
+
+void bucket_take(Bucket* b) {
+	if(b->rate > 0) b->tokens -= 1;
+}
+
+// Breaker
+// Circuit breaker: after threshold failures in a row the provider is
+// considered down for cooldown ms, then one probe request decides.
+#define BREAKER_COOLDOWN 5000
+#define BREAKER_MAX_COOLDOWN 300000
+
+typedef struct Breaker {
+	int failures;      // in a row
+	int threshold;
+	double cooldown;   // ms
+	double open_until; // ms, 0 - closed
+	int probing;       // half open and the probe is out
+} Breaker;
+
+void breaker_init(Breaker* b, int threshold) {
+	b->failures = 0;
+	b->threshold = threshold;
+	b->cooldown = BREAKER_COOLDOWN;
+	b->open_until = 0;
+	b->probing = 0;
+}
+
+int breaker_open(Breaker* b) {
+	return b->open_until != 0 && time_ms() < b->open_until;
+}
+
+// may a request go out now, takes the probe slot when half open
+int breaker_allow(Breaker* b) {
+	if(b->open_until == 0) return 1;
+	if(time_ms() < b->open_until || b->probing) return 0;
+	b->probing = 1;
+	return 1;
+}
+
+void breaker_result(Breaker* b, int ok) {
+	int was_open = b->open_until != 0;
+	if(ok) {
+		if(was_open) print("circuit closed\n");
+		breaker_init(b, b->threshold);
+		return;
+	}
+	b->probing = 0;
+	++b->failures;
+	if(breaker_open(b)) return; // late answers of requests sent before it opened
+	if(b->failures < b->threshold && !was_open) return;
+	if(was_open) b->cooldown = mind(b->cooldown * 2, BREAKER_MAX_COOLDOWN); // probe failed
+	b->open_until = time_ms() + b->cooldown;
+	print("circuit open for %.0f s after %d failures\n", b->cooldown / 1000, b->failures);
+}
+
+// Latency
+// recent transfer times of a provider and their 90th percentile
+#define LATENCY_SAMPLES 128
+
+typedef struct Latency {
+	double ms[LATENCY_SAMPLES];
+	int count;
+	int pos;
+	double p90;  // 0 - not enough samples yet
+} Latency;
+
+int cmp_double(const void* l, const void* r) {
+	double a = *(const double*)l, b = *(const double*)r;
+	return a < b ? -1 : a > b;
+}
+
+void latency_add(Latency* l, double ms) {
+	l->ms[l->pos] = ms;
+	l->pos = (l->pos + 1) % LATENCY_SAMPLES;
+	if(l->count < LATENCY_SAMPLES) ++l->count;
+	if(l->count >= 32 && l->pos % 16 == 0) {
+		double sorted[LATENCY_SAMPLES];
+		memcpy(sorted, l->ms, l->count * sizeof(double));
+		qsort(sorted, l->count, sizeof(double), cmp_double);
+		l->p90 = sorted[l->count * 9 / 10];
+	}
+}
+
+// Window
+// AIMD limit of transfers in flight: one more after a window's worth of
+// good answers while latency stays near its floor, halved on throttling
+// or a latency spike, at most once per round trip. Until the first cut
+// it grows by one per good answer.
+typedef struct Window {
+	double size;
+	int min;
+	int max;
+	double floor;     // ms, lowest recent latency
+	double avg;       // ms, smoothed latency
+	int acked;        // good answers since the last change
+	int steady;       // cut once, additive increase only
+	double hold;      // ms, no other cut before this
+} Window;
+
+void window_init(Window* w, int size, int min, int max) {
+	memset(w, 0, sizeof(Window));
+	w->min = min;
+	w->max = maxi(min, max);
+	w->size = clamp(size, w->min, w->max);
+}
+
+void window_cut(Window* w) {
+	double now = time_ms();
+	if(now < w->hold) return;
+	w->size = maxd(w->size / 2, w->min);
+	w->acked = 0;
+	w->steady = 1;
+	w->hold = now + maxd(w->floor * 2, 100);
+}
+
+// a good answer after ms, full - the window was the limit when it went out
+void window_ok(Window* w, double ms, int full) {
+	if(w->floor == 0 || ms < w->floor) w->floor = ms;
+	else w->floor += (ms - w->floor) / 256; // forget an old floor slowly
+	w->avg = w->avg == 0 ? ms : w->avg + (ms - w->avg) / 8;
+	if(w->avg > w->floor * 3 + 50) {
+		window_cut(w);
+		return;
+	}
+	if(full && (!w->steady || ++w->acked >= (int)w->size)) {
+		w->size = mind(w->size + 1, w->max);
+		w->acked = 0;
+	}
+}
+
+// Source
+// Mirrors tried before the provider, in order: local directories and
+// LAN http caches laid out like our own cache, <base>/<name>/z/x/y.ext,
+// MBTiles files and archives. Each has its own limits and breaker, a miss
+// falls through to the next.
+#define MAX_SOURCES 4
+
+enum { SOURCE_DIR, SOURCE_HTTP, SOURCE_MBTILES, SOURCE_ARCHIVE };
+
+typedef struct Source {
+	int kind;
+	char base[128];       // directory or url prefix
+	int conns;            // max transfers at once
+	int connect_timeout;  // ms
+	int inflight;
+	Bucket bucket;
+	Breaker breaker;
+	int hits;
+	int misses;
+	struct Mbtiles* mb;   // SOURCE_MBTILES, opened by store_init
+	struct Archive* arc;  // SOURCE_ARCHIVE, local or http
+} Source;
+
+void source_init(Source* s, const char* base) {
+	size_t n = strlen(base);
+	memset(s, 0, sizeof(Source));
+	s->kind = strncmp(base, "http://", 7) == 0 || strncmp(base, "https://", 8) == 0 ? SOURCE_HTTP : SOURCE_DIR;
+	if(n > 8 && strcmp(base + n - 8, ".mbtiles") == 0) s->kind = SOURCE_MBTILES;
+	if(n > 4 && strcmp(base + n - 4, ".gpa") == 0) s->kind = SOURCE_ARCHIVE;
+	strncpy(s->base, base, sizeof(s->base) - 1);
+	if(s->base[0] && s->base[strlen(s->base) - 1] == '/') s->base[strlen(s->base) - 1] = 0;
+	s->conns = 32;
+	s->connect_timeout = 1000;
+	bucket_init(&s->bucket, 1000, 1000);
+	breaker_init(&s->breaker, 4);
+}
+
+// Signature
+// Size and hash of a provider "no imagery" tile. Such tiles are recorded
+// as no data instead of being cached and drawn.
+#define MAX_SIGNATURES 8
+
+typedef struct Signature {
+	size_t size;
+	unsigned long long hash; // FNV-1a
+} Signature;
+
+unsigned long long fnv1a(const char* p, size_t n) {
+	unsigned long long h = 14695981039346656037ull;
+	size_t i;
+	for(i = 0; i < n; ++i) {
+		h ^= (unsigned char)p[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
 // MapProvider
-typedef void(*MakeUrl)(void*,Tile*,char*);
+#define SUBDOMAINS 4
+
+typedef void(*MakeUrl)(void*,Tile*,int,char*);
 
 typedef struct MapProvider {
 	char name[16];
-	char subdomians[4][4];
+	char subdomians[SUBDOMAINS][4];
 	char urlformat[128];
 	char imgformat[5];
 	MakeUrl makeurl;
+
+	int ttl;                      // seconds before a cached tile is revalidated, 0 - never
+	int connect_timeout;          // ms
+	int timeout;                  // ms, whole transfer
+	int low_speed;                // bytes/s, slower than this for
+	int low_speed_time;           // seconds is a stall
+	int host_conns;               // max transfers per subdomain
+	int host_inflight[SUBDOMAINS];
+	Bucket bucket;
+	Breaker breaker;
+	int hedge_pct;                // max duplicate requests, % of all, 0 - off
+	Latency latency;
+	Window window;                // adaptive limit of transfers at once
+	int offline;                  // cache only, never touch the network
+	int store;                    // STORE_FILES, STORE_PACK or STORE_MBTILES
+	char mbtiles[128];            // STORE_MBTILES file
+	double quota;                 // bytes of tiles on disk, 0 - no limit
+	int pin_zoom;                 // tiles up to this zoom stay whatever the quota
+	Signature nodata[MAX_SIGNATURES]; // placeholder tiles
+	int nodata_count;
+	char nodata_header[32];       // response header that marks a placeholder
+	char nodata_value[16];
+	Source sources[MAX_SOURCES];  // mirrors, before the provider
+	int sources_count;
 } MapProvider;
 
 // Global Vars
@@ -637,7 +947,8 @@ Queue* tiles_load;
 Array* tiles_loaded;
 Array* tiles_release;
 Array* tiles_blend;
-Tile* tiles_draw[64];
+#define TILES_DRAW_MAX 256
+Tile* tiles_draw[TILES_DRAW_MAX];
 int tiles_draw_count = 0;
 float texcoord[8];
 
@@ -651,7 +962,22 @@ int tile_release(Tile* t) {
 	return 0;
 }
 
+// limits shared by all providers, init functions override them
+void mapprovider_init(MapProvider* map) {
+	memset(map, 0, sizeof(MapProvider));
+	map->ttl = 30 * 24 * 3600;
+	map->connect_timeout = 5000;
+	map->timeout = 30000;
+	map->low_speed = 1024;
+	map->low_speed_time = 10;
+	map->host_conns = 8;
+	map->pin_zoom = 8;
+	bucket_init(&map->bucket, 50, 100);
+	breaker_init(&map->breaker, 16);
+}
+
 void initMqcdnMap(MapProvider* map) {
+	mapprovider_init(map);
 	map->makeurl=0;
 
 	sprintf(map->name,"mqcdn");
@@ -664,7 +990,12 @@ void initMqcdnMap(MapProvider* map) {
 }
 
 void initOSMMap(MapProvider* map) {
+	mapprovider_init(map);
 	map->makeurl=0;
+	// tile usage policy: few connections, no bulk downloading
+	map->host_conns = 2;
+	bucket_init(&map->bucket, 20, 40);
+	map->ttl = 7 * 24 * 3600;
 
 	sprintf(map->name,"osm");
 	sprintf(map->subdomians[0],"");
@@ -675,11 +1006,10 @@ void initOSMMap(MapProvider* map) {
 	sprintf(map->imgformat,"png");
 }
 
-void getBindUrl(void* m,Tile* tile, char* url){
+void getBindUrl(void* m,Tile* tile, int r, char* url){
 	MapProvider* map = (MapProvider*)m;
 	int i = tile->z;
 	char key[64]="";
-	int r = rand()%4;
 	for (; i > 0; --i) {
 		int digit=0;
 		char d[2];
@@ -693,7 +1023,11 @@ void getBindUrl(void* m,Tile* tile, char* url){
 }
 void initBingMap(MapProvider* map) {
 	//zoom max 21
+	mapprovider_init(map);
 	map->makeurl = getBindUrl;
+	// "no imagery" tiles of high zooms
+	sprintf(map->nodata_header,"X-VE-Tile-Info");
+	sprintf(map->nodata_value,"no-tile");
 
 	sprintf(map->name,"bing");
 	sprintf(map->subdomians[0],"t0");
@@ -703,14 +1037,15 @@ void initBingMap(MapProvider* map) {
 	sprintf(map->imgformat,"jpeg");
 }
 
-void getYahooUrl(void* map,Tile* tile, char* url){
+void getYahooUrl(void* map,Tile* tile, int r, char* url){
 	int x = tile->x;
 	int y = ((1<<tile->z)-1) - tile->y - 1;
 	int z = 18 - tile->z;
 	sprintf(url,"http://us.maps3.yimg.com/aerial.maps.yimg.com/tile?v=1.7&t=a&x=%d&y=%d&z=%d",x,y,z);
-	(void)map;
+	(void)map; (void)r;
 }
 void initYahooMap(MapProvider* map) {
+	mapprovider_init(map);
 	map->makeurl = getYahooUrl;
 
 	sprintf(map->name,"yahoo");
@@ -722,6 +1057,7 @@ void initYahooMap(MapProvider* map) {
 }
 
 void initYndexMap(MapProvider* map) {
+	mapprovider_init(map);
 	map->makeurl = 0;
 
 	sprintf(map->name,"yandex");
@@ -742,11 +1078,34 @@ void mapprovider_getFileName(MapProvider* map,Tile* tile,char* filename) {
 	sprintf(filename,"%s/%d/%d/%d.%s",map->name,tile->z,tile->x,tile->y,map->imgformat);
 }
 
-void mapprovider_getUrlName(MapProvider* map,Tile* tile,char* url) {
+// bytes of a "no imagery" tile
+int mapprovider_placeholder(MapProvider* map, const char* data, size_t size) {
+	int i;
+	unsigned long long hash = 0;
+	for(i = 0; i < map->nodata_count; ++i) {
+		if(map->nodata[i].size != size) continue;
+		if(!hash) hash = fnv1a(data, size);
+		if(map->nodata[i].hash == hash) return 1;
+	}
+	return 0;
+}
+
+int mapprovider_inflight(MapProvider* map) {
+	int i, n = 0;
+	for(i = 0; i < SUBDOMAINS; ++i) n += map->host_inflight[i];
+	return n;
+}
+
+// same tile always goes to the same host, so CDN and proxy caches work
+int mapprovider_subdomain(MapProvider* map, Tile* tile) {
+	(void)map;
+	return tile_hash(tile) % SUBDOMAINS;
+}
+
+void mapprovider_getUrlName(MapProvider* map,Tile* tile,int r,char* url) {
 	if (map->makeurl){
-		map->makeurl(map,tile,url);
+		map->makeurl(map,tile,r,url);
 	} else {
-		int r = rand()%4;
 		sprintf(url,map->urlformat,map->subdomians[r],tile->z,tile->x,tile->y,map->imgformat);
 	}
 }
@@ -757,217 +1116,3871 @@ size_t write_data(void *ptr, size_t size, size_t nmemb, FILE *stream) {
 	return written;
 }
 
-stbi_uc* getImageData(Tile* tile) {
-	char filename[64];
-	stbi_uc* data=0;
-	int w,h,comp;
-	mapprovider_getFileName(&map,tile,filename);
-	if(exists(filename)) {
-		data = stbi_load(filename, &w, &h, &comp, 0);
-	} else {
-		CURL* curl = curl_easy_init();
-		if (curl) {
-			char url[128];
-			char uagent[128]= "curl/" ;
-			char tmp[64];
-			FILE* stream=0;
-			mapprovider_getUrlName(&map,tile,url);
-			mkpath(filename);
-			//tmpnam(tmp);
-			strcpy(tmp,filename);
-			strcat(tmp,".tmp");
-			stream=fopen(tmp, "wb");
-			curl_easy_setopt(curl, CURLOPT_URL, url);
-			curl_easy_setopt(curl, CURLOPT_WRITEDATA, stream);
-
-			curl_version_info_data* version_info = curl_version_info(CURLVERSION_NOW);
-			strcat(uagent, version_info->version);
-			curl_easy_setopt(curl, CURLOPT_USERAGENT, version_info->version);
-
-			//curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
-			//print("download url %s\n",url);
-			CURLcode ret = curl_easy_perform(curl);
-			fclose(stream);
-			rename(tmp,filename);
-
-			data = stbi_load(filename,&w,&h,&comp,0);
-			curl_easy_cleanup(curl);
-		}
-	}
-	return data;
+// Loader
+// Loader threads read and decode tiles, downloads go through the net thread.
+#define MAX_LOADERS 16
+
+typedef struct Loader {
+	int id;
+} Loader;
+
+Loader loaders[MAX_LOADERS];
+int loaders_count = 0;
+
+// DNS cache and TLS sessions are shared between all curl handles,
+// connections live in the multi handle of the net thread.
+CURLSH* share;
+mtx_t share_mtx[CURL_LOCK_DATA_LAST];
+
+static void share_lock(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr) {
+	mtx_lock(&share_mtx[data]);
+	(void)handle; (void)access; (void)userptr;
 }
 
-void tiles_limit() {
-	if(tiles->count > 512) {// 4*6*18=432. 512 tiles ~100mb texures
-		int n = tiles->count - 512;
-		while(n--) {
-			Tile* t = (Tile*)tiles->last->data;
-			//if(t->z != 1) { // todo: keet top
-				deque_pop_back(tiles);
-				tile_release(t);
-				//t = deque_removedata_s(tiles_load, t); // always last??
-				//if(t) tile_release(t);
-				//mtx_lock(&tiles_load->mtx);
-				if (tiles_load->count == 0) {
-					// it's happen
-					//print("not must happen tiles_limit tiles_load->count == 0 n %d count %d\n",n, tiles->count);
-					//mtx_unlock(&tiles_load->mtx);
-					continue;
-				}
-				if (tiles_load->last->data == (char*)t){
-					deque_pop_back(tiles_load);
-					tile_release(t);
-				} else {
-					t = deque_removedata_s(tiles_load, t); // always last??
-					if(t) {
-						//print("not must happen in tiles_limit\n");
-						tile_release(t);
-					}
-				}
-				//mtx_unlock(&tiles_load->mtx);
-			//}
-		}
-	}
+static void share_unlock(CURL* handle, curl_lock_data data, void* userptr) {
+	mtx_unlock(&share_mtx[data]);
+	(void)handle; (void)userptr;
 }
 
-Tile* tile_new(int x, int y, int z){
-//	char filename[64];
-	Tile* newtile = (Tile*)malloc(sizeof(Tile));
-	tile_init(newtile, x, y, z);
-	tile_make(newtile);
+void share_init() {
+	int i;
+	for(i = 0; i < CURL_LOCK_DATA_LAST; ++i) mtx_init(&share_mtx[i]);
+	share = curl_share_init();
+	curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock);
+	curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+}
 
-	if (tile_tofirst_s(tiles_load,newtile) == 0){
-		newtile->ref += 1;
-		deque_push_front_s(tiles_load, newtile);
-	} else {
-		//print("new in load\n");
+CURL* curl_make_handle() {
+	char uagent[128] = "curl/";
+	CURL* curl = curl_easy_init();
+	if(!curl) return 0;
+	strcat(uagent, curl_version_info(CURLVERSION_NOW)->version);
+	curl_easy_setopt(curl, CURLOPT_USERAGENT, uagent);
+	curl_easy_setopt(curl, CURLOPT_SHARE, share);
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+	curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+	return curl;
+}
+
+Loader* loader_init(Loader* l, int id) {
+	l->id = id;
+	return l;
+}
+
+// Buf
+// Growable byte buffer for downloaded tiles. Buffers are pooled, a tile
+// download does not malloc once the pool is warm.
+#define BUF_POOL_MAX 64
+#define BUF_KEEP_CAP (256 * 1024)
+
+typedef struct Buf {
+	char* data;
+	size_t size;
+	size_t cap;
+} Buf;
+
+Array* buf_pool;
+mtx_t buf_mtx;
+
+void buf_init() {
+	buf_pool = make_array(BUF_POOL_MAX);
+	mtx_init(&buf_mtx);
+}
+
+Buf* buf_get() {
+	Buf* b;
+	mtx_lock(&buf_mtx);
+	b = array_pop(buf_pool);
+	mtx_unlock(&buf_mtx);
+	if(!b) {
+		b = (Buf*)malloc(sizeof(Buf));
+		b->cap = 32 * 1024;
+		b->data = malloc(b->cap);
 	}
+	b->size = 0;
+	return b;
+}
 
-	deque_push_front(tiles, newtile);
-	
-	return newtile;
+void buf_put(Buf* b) {
+	mtx_lock(&buf_mtx);
+	if(buf_pool->count < BUF_POOL_MAX && b->cap <= BUF_KEEP_CAP) {
+		array_push(buf_pool, b);
+		b = 0;
+	}
+	mtx_unlock(&buf_mtx);
+	if(b) {
+		free(b->data);
+		free(b);
+	}
 }
 
-void to_draw(int z, int x, int y) {
-	Tile tile = {z,x,y};
-	Tile* ret = tile_find(tiles, &tile);
-	if(ret == 0) {
-		Tile* newtile = tile_new(x,y,z);
-		tiles_draw[tiles_draw_count++] = newtile;
-	} else {
-		tile_tofirst(tiles,ret); // FIXME:!! second search
-		tile_tofirst_s(tiles_load,ret);
-		tiles_draw[tiles_draw_count++] = ret;
+size_t buf_write(void* ptr, size_t size, size_t nmemb, void* userp) {
+	Buf* b = (Buf*)userp;
+	size_t n = size * nmemb;
+	if(b->size + n > b->cap) {
+		size_t cap = b->cap * 2;
+		char* data;
+		if(cap < b->size + n) cap = b->size + n;
+		data = realloc(b->data, cap);
+		if(!data) return 0;
+		b->data = data;
+		b->cap = cap;
 	}
+	memcpy(b->data + b->size, ptr, n);
+	b->size += n;
+	return n;
 }
 
-void make_tiles() {
-	int j;
-	int baseZoom = clamp((int)floor(center.zoom+0.5), 0, 18);
+// room for n bytes, 0 - out of memory
+int buf_reserve(Buf* b, size_t n) {
+	char* data;
+	if(n <= b->cap) return 1;
+	if((data = realloc(b->data, n)) == 0) return 0;
+	b->data = data;
+	b->cap = n;
+	return 1;
+}
 
-	double tl[2]= {0,0};
-	double tr[2]= {(double)veiwport[0],0};
-	double bl[2]= {0,(double)veiwport[1]};
-	double br[2]= {(double)veiwport[0],(double)veiwport[1]};
+// Store
+// Where the cache lives. By default the TMS layout <name>/z/x/y.ext, a
+// file per tile. -store pack keeps tiles in one append-only pack instead,
+// -store file.mbtiles in an MBTiles file.
+// get runs on loaders, has anywhere, put, del and sync on the writer.
+enum { STORE_FILES, STORE_PACK, STORE_MBTILES };
+
+typedef struct TileStore {
+	Buf* (*get)(Loader* l, int z, int x, int y, time_t* mtime); // 0 - not stored
+	int (*has)(int z, int x, int y);
+	int (*put)(int z, int x, int y, Buf* b);
+	void (*del)(int z, int x, int y);
+	void (*sync)(int now); // make what was put durable, else at most once a second. 0 - nothing to do
+	void (*scan)(void (*fn)(unsigned long long key)); // stored tiles, 0 - crawl the directory
+	void (*ahead)(const unsigned long long* keys, int n); // start reading tiles into the page cache, 0 - can't
+} TileStore;
+
+TileStore store;
+
+// How hard the writer makes saved tiles durable: none - up to the OS,
+// batch - the store is synced after each batch the writer takes, tile -
+// every tile is synced before the next one. -durability none|batch|tile
+enum { DURABLE_NONE, DURABLE_BATCH, DURABLE_TILE };
+int save_durability = DURABLE_NONE;
+
+// whole file in a pooled buffer, 0 - missing, empty or unreadable
+Buf* file_read(const char* path) {
+	char chunk[16 * 1024];
+	FILE* f;
+	Buf* b;
+	size_t n;
+	if((f = fopen(path, "rb")) == 0) return 0;
+	b = buf_get();
+	while((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+		if(buf_write(chunk, 1, n, b) != n) break;
+	}
+	if(ferror(f) || b->size == 0) {
+		buf_put(b);
+		b = 0;
+	}
+	fclose(f);
+	return b;
+}
 
-	int minCol, maxCol;
-	int minRow, maxRow;
-	int row_count;//, col;
+void tile_filename(int z, int x, int y, char* filename) {
+	Tile t;
+	tile_init(&t, x, y, z);
+	mapprovider_getFileName(&map, &t, filename);
+}
 
-	crd_t ctl, ctr;
-	crd_t cbl, cbr;
-	crd_set2(&ctl,&center,tl,br);
-	crd_zoomto(&ctl,baseZoom);
-	crd_set2(&ctr,&center,tr,br);
-	crd_zoomto(&ctr,baseZoom);
-	crd_set2(&cbl,&center,bl,br);
-	crd_zoomto(&cbl,baseZoom);
-	crd_set2(&cbr,&center,br,br);
-	crd_zoomto(&cbr,baseZoom);
+Buf* files_get(Loader* l, int z, int x, int y, time_t* mtime) {
+	char filename[64];
+	struct stat st;
+	(void)l;
+	tile_filename(z, x, y, filename);
+	if(stat(filename, &st) != 0) return 0;
+	*mtime = st.st_mtime;
+	return file_read(filename);
+}
 
-	minCol = (int)floor(_mind(mind(ctl.column,ctr.column),mind(cbl.column,cbr.column)));
-	maxCol = (int)floor(_maxd(maxd(ctl.column,ctr.column),maxd(cbl.column,cbr.column)));
-	minRow = (int)floor(_mind(mind(ctl.row,ctr.row),mind(cbl.row,cbr.row)));
-	maxRow = (int)floor(_maxd(maxd(ctl.row,ctr.row),maxd(cbl.row,cbr.row)));
+int files_has(int z, int x, int y) {
+	char filename[64];
+	tile_filename(z, x, y, filename);
+	return exists(filename);
+}
 
-	minCol -= 2;//FIXME: calc veiwport area
-	maxCol += 2;
+#if __linux || __APPLE__
+// the kernel starts reading len bytes at off, we don't wait for them
+void file_willneed(int fd, off_t off, off_t len) {
+#if __linux
+	posix_fadvise(fd, off, len, POSIX_FADV_WILLNEED);
+#else
+	struct radvisory ra;
+	ra.ra_offset = off;
+	ra.ra_count = len ? (int)len : 1 << 20;
+	fcntl(fd, F_RDADVISE, &ra);
+#endif
+}
 
-	row_count = (int)floor(pow(2.0, baseZoom))-1;
-	minCol = maxi(0,minCol);
-	minRow = maxi(0,minRow);
-	maxCol = mini(maxCol,row_count);
-	maxRow = mini(maxRow,row_count);
+void files_ahead(const unsigned long long* keys, int n) {
+	int i;
+	for(i = 0; i < n; ++i) {
+		char filename[64];
+		Tile t;
+		int fd;
+		key_tile(keys[i], &t);
+		tile_filename(t.z, t.x, t.y, filename);
+		if((fd = open(filename, O_RDONLY)) < 0) continue;
+		file_willneed(fd, 0, 0);
+		close(fd);
+	}
+}
+#endif
 
-	tiles_draw_count = 0;
+// Directories a put made or found, so the next put into them does not
+// stat and mkdir every path component again. All are forgotten when a
+// file can't be created in one, someone removed it, and failures are rare
+// enough that open addressing needs no deletes.
+#define DIRS_MAX 4096
 
-	{
-		//int j;
-		int nx = maxCol;
-		int ny = maxRow;
-		int sx = minCol;
-		int sy = minRow;
-		int n = (nx-sx+1)*(ny-sy+1);
-		int sn = n;
-		//
-		Tile t[128],p;
-		int t_count=0;
-		Node* node;
+typedef struct DirCache {
+	unsigned long long hash[DIRS_MAX]; // fnv1a of the path, 0 - empty
+	int count;
+	int init;
+	mtx_t mtx;
+} DirCache;
 
-		//
-		while(n) {
-			for(j = sy; j <= ny; ++j) {
-				to_draw(baseZoom, nx, j); --n;
-			} if(!n) break;
-			nx--;
-			for(j = nx; j >= sx; --j) {
-				to_draw(baseZoom, j, ny); --n;
-			} if(!n) break;
-			ny--;
-			for(j = ny; j >= sy; --j) {
-				to_draw(baseZoom, sx, j); --n;
-			} if(!n) break;
-			sx++;
-			for(j = sx; j <= nx; ++j) {
-				to_draw(baseZoom, j, sy); --n;
-			} if(!n) break;
-			sy++;
-		}
+DirCache dirs;
 
-		node = tiles->first;
-		for(; sn; --sn) {
-			Tile* c = (Tile*)node->data;
-			tile_parent(c, &p);
-			while(p.z > 0) {
-				int has = 0;
-				c = tile_find(tiles, &p);
-				if(c == 0) {
-					for(j = 0; j < t_count; ++j) {
-						Tile* tt = &t[j];
-						if(tt->z == p.z&&tt->x == p.x&&tt->y == p.y) { has = 1; break; }
-					}
-					if(!has) t[t_count++] = p;
-				} else {
-					tile_tofirst(tiles, c); // FIXME:!! second search
-					tile_tofirst_s(tiles_load, c);
-				}
-				tile_parent(&p, &p);
-			}
-			node = node->next;
-		}
-		qsort(t,t_count,sizeof(Tile),cmp_tile);
+// slot of the directory of filename, its hash or 0
+static unsigned long long* dirs_slot(const char* filename, unsigned long long* hash) {
+	const char* end = strrchr(filename, '/');
+	unsigned long long h = fnv1a(filename, end ? (size_t)(end - filename) : 0);
+	int i;
+	h += !h;
+	for(i = (int)(h >> 32) & (DIRS_MAX - 1); dirs.hash[i] && dirs.hash[i] != h; i = (i + 1) & (DIRS_MAX - 1));
+	*hash = h;
+	return &dirs.hash[i];
+}
 
-		for(j = t_count-1; j >= 0; --j) {
-			/*Tile* newtile = */tile_new(t[j].x, t[j].y, t[j].z);
+// the directory of filename is there, 0 - can't make it
+int files_dir(const char* filename) {
+	unsigned long long *slot, h;
+	int made = 1;
+	mtx_lock(&dirs.mtx);
+	if(dirs.count * 2 >= DIRS_MAX) { // full, start over
+		memset(dirs.hash, 0, sizeof(dirs.hash));
+		dirs.count = 0;
+	}
+	slot = dirs_slot(filename, &h);
+	if(!*slot) {
+		made = mkpath(filename) == 0;
+		if(made) {
+			*slot = h;
+			++dirs.count;
 		}
 	}
+	mtx_unlock(&dirs.mtx);
+	return made;
 }
 
-void do_exit(void){
-	//destroy_synclist(tiles_get);
-	//clear_list(tiles);
-	//destroy_list(tiles);
-	//destroyMap(&map);
+void files_dir_forget() {
+	mtx_lock(&dirs.mtx);
+	memset(dirs.hash, 0, sizeof(dirs.hash));
+	dirs.count = 0;
+	mtx_unlock(&dirs.mtx);
+}
+
+int files_unsynced;
+
+#define FILES_TMP 100 // z/x/y.ext.pid.seq.tmp
+unsigned long long files_tmp_seq;
+
+// a tmp name for filename that no other writer, thread or process, has
+// at the same time, or two of them saving the same tile write one file
+void files_tmp(const char* filename, char* tmp) {
+	unsigned long long n;
+	do n = files_tmp_seq; while(!cas64(&files_tmp_seq, n, n + 1));
+	sprintf(tmp, "%s.%d.%llu.tmp", filename, process_id(), n);
+}
+
+int files_put(int z, int x, int y, Buf* buf) {
+	char filename[64], tmp[FILES_TMP];
+	FILE* f;
+	size_t n;
+	tile_filename(z, x, y, filename);
+	files_tmp(filename, tmp);
+	if(!files_dir(filename)) return 0;
+	if((f = fopen(tmp, "wb")) == 0) {
+		files_dir_forget();
+		if(!files_dir(filename) || (f = fopen(tmp, "wb")) == 0) return 0;
+	}
+	n = fwrite(buf->data, 1, buf->size, f);
+#if __linux || __APPLE__
+	if(save_durability == DURABLE_TILE && n == buf->size && (fflush(f) != 0 || fsync(fileno(f)) != 0)) n = 0;
+#endif
+	if(fclose(f) != 0 || n != buf->size) {
+		remove(tmp);
+		return 0;
+	}
+	files_unsynced = 1;
+	return rename(tmp, filename) == 0;
+}
+
+// batch durability, whatever was written to the file system the cache is on
+void files_sync(int now) {
+	(void)now;
+	if(save_durability != DURABLE_BATCH || !files_unsynced) return;
+	files_unsynced = 0;
+#if __linux
+	{
+		int fd = open(map.name, O_RDONLY | O_DIRECTORY);
+		if(fd >= 0) {
+			syncfs(fd);
+			close(fd);
+		}
+	}
+#elif __APPLE__
+	sync();
+#endif
+}
+
+void files_del(int z, int x, int y) {
+	char filename[64];
+	tile_filename(z, x, y, filename);
+	remove(filename);
+}
+
+// Pack
+// <name>/tiles.pack holds records appended one after another, a header
+// and the tile bytes. <name>/tiles.idx is a hash table from tile key to
+// record, mapped by every process that reads the pack. One process, the
+// one holding the lock on tiles.pack, appends. A commit syncs the data,
+// then the index, then moves committed forward. On open the writer
+// replays records past committed, cuts a torn tail and forgets slots
+// that pointed into it. Overwritten and removed records stay as garbage.
+#if __linux || __APPLE__
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+
+#define PACK_MAGIC 0x6b637067u // "gpck"
+#define PACK_INDEX_MAGIC "gppack1"
+#define PACK_SYNC 1024         // records between commits, else once a second
+#define PACK_LEN_BITS 24       // 16 MB records, 1 TB packs
+#define PACK_AHEAD_GAP 65536   // records closer are read ahead as one range
+#define PACK_LOC(off, len) ((unsigned long long)(off) << PACK_LEN_BITS | (len))
+
+typedef struct PackRecord {
+	unsigned int magic;
+	unsigned int len;       // bytes after the header
+	unsigned long long key; // tile_key
+	unsigned int mtime;
+	unsigned int crc;       // of the bytes
+} PackRecord;
+
+typedef struct PackSlot {
+	unsigned long long key;          // tile_key, 0 - empty
+	volatile unsigned long long loc; // PACK_LOC, 0 - removed
+	unsigned int mtime;
+	unsigned int pad;
+} PackSlot;
+
+typedef struct PackIndex {
+	char magic[8];                // written last
+	unsigned long long cap;       // slots, a power of two
+	unsigned long long count;     // used slots, removed too
+	unsigned long long committed; // data bytes every slot is in sync with
+	volatile int moved;           // grown into a new file, map that one
+	int pad;
+	PackSlot slots[1];
+} PackIndex;
+
+typedef struct Pack {
+	int fd;
+	int writer;             // this process appends
+	PackIndex* idx;
+	size_t idx_size;
+	unsigned long long end; // data bytes, writer
+	int unsynced;           // records since the last commit
+	double synced;          // ms
+	double opened;          // ms, last try to map the index
+	mtx_t mtx;              // idx within the process
+	char idx_path[64];
+} Pack;
+
+Pack pack;
+
+unsigned int crc32_update(unsigned int crc, const unsigned char* p, size_t n);
+
+static size_t pack_idx_size(unsigned long long cap) {
+	return sizeof(PackIndex) + (size_t)(cap - 1) * sizeof(PackSlot);
+}
+
+static PackIndex* pack_map(const char* path, int writable, size_t* size) {
+	struct stat st;
+	PackIndex* idx;
+	void* p;
+	int fd = open(path, writable ? O_RDWR : O_RDONLY);
+	if(fd < 0) return 0;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PackIndex)) {
+		close(fd);
+		return 0;
+	}
+	p = mmap(0, (size_t)st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED) return 0;
+	idx = (PackIndex*)p;
+	if(memcmp(idx->magic, PACK_INDEX_MAGIC, 8) != 0 || pack_idx_size(idx->cap) > (size_t)st.st_size) {
+		munmap(p, (size_t)st.st_size);
+		return 0;
+	}
+	*size = (size_t)st.st_size;
+	return idx;
+}
+
+// an empty index in path.tmp, renamed over path once it is filled
+static PackIndex* pack_idx_new(const char* path, unsigned long long cap, size_t* size) {
+	char tmp[68];
+	PackIndex* idx;
+	void* p;
+	int fd;
+	sprintf(tmp, "%s.tmp", path);
+	*size = pack_idx_size(cap);
+	if((fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) return 0;
+	if(ftruncate(fd, (off_t)*size) != 0) {
+		close(fd);
+		return 0;
+	}
+	p = mmap(0, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED) return 0;
+	idx = (PackIndex*)p;
+	idx->cap = cap;
+	memcpy(idx->magic, PACK_INDEX_MAGIC, 8);
+	return idx;
+}
+
+static int pack_idx_publish(PackIndex* idx, size_t size, const char* path) {
+	char tmp[68];
+	sprintf(tmp, "%s.tmp", path);
+	msync(idx, size, MS_SYNC);
+	return rename(tmp, path) == 0;
+}
+
+static PackSlot* pack_slot(PackIndex* idx, unsigned long long key) {
+	unsigned long long mask = idx->cap - 1, i = (key * 0x9e3779b97f4a7c15ull >> 32) & mask;
+	while(idx->slots[i].key && idx->slots[i].key != key) i = (i + 1) & mask;
+	return &idx->slots[i];
+}
+
+// writer, under pack.mtx. Readers of other processes see the slot whole:
+// loc is set before the key
+static void pack_insert(unsigned long long key, unsigned long long loc, unsigned int mtime) {
+	PackSlot* s;
+	if((pack.idx->count + 1) * 10 > pack.idx->cap * 7) {
+		size_t size;
+		unsigned long long i;
+		PackIndex* old = pack.idx;
+		PackIndex* idx = pack_idx_new(pack.idx_path, old->cap * 2, &size);
+		if(!idx) return;
+		for(i = 0; i < old->cap; ++i) {
+			PackSlot* o = &old->slots[i];
+			if(!o->key || !o->loc) continue;
+			*pack_slot(idx, o->key) = *o;
+			++idx->count;
+		}
+		idx->committed = old->committed;
+		if(!pack_idx_publish(idx, size, pack.idx_path)) {
+			munmap(idx, size);
+			return;
+		}
+		old->moved = 1;
+		munmap(old, pack.idx_size);
+		pack.idx = idx;
+		pack.idx_size = size;
+	}
+	s = pack_slot(pack.idx, key);
+	s->mtime = mtime;
+	s->loc = loc;
+	if(!s->key) {
+		memory_barrier();
+		s->key = key;
+		++pack.idx->count;
+	}
+}
+
+// 0 - not there
+static unsigned long long pack_lookup(unsigned long long key, unsigned int* mtime) {
+	unsigned long long loc = 0;
+	mtx_lock(&pack.mtx);
+	if(!pack.writer && (!pack.idx || pack.idx->moved) && time_ms() - pack.opened > 1000) { // the writer grew it
+		PackIndex* idx;
+		size_t size;
+		pack.opened = time_ms();
+		if((idx = pack_map(pack.idx_path, 0, &size)) != 0) {
+			if(pack.idx) munmap(pack.idx, pack.idx_size);
+			pack.idx = idx;
+			pack.idx_size = size;
+		}
+	}
+	if(pack.idx) {
+		PackSlot* s = pack_slot(pack.idx, key);
+		if(s->key == key) {
+			loc = s->loc;
+			*mtime = s->mtime;
+		}
+	}
+	mtx_unlock(&pack.mtx);
+	return loc;
+}
+
+void pack_commit(int now) {
+	if(!pack.writer || !pack.unsynced || (!now && time_ms() - pack.synced < 1000)) return;
+#if __APPLE__
+	fsync(pack.fd);
+#else
+	fdatasync(pack.fd);
+#endif
+	mtx_lock(&pack.mtx);
+	msync(pack.idx, pack.idx_size, MS_SYNC);
+	pack.idx->committed = pack.end;
+	mtx_unlock(&pack.mtx);
+	pack.unsynced = 0;
+	pack.synced = time_ms();
+}
+
+// writer
+int pack_append(unsigned long long key, const char* data, size_t len, unsigned int mtime) {
+	PackRecord r;
+	unsigned long long off = pack.end;
+	if(!pack.writer || len >= 1u << PACK_LEN_BITS) return 0;
+	r.magic = PACK_MAGIC;
+	r.len = (unsigned int)len;
+	r.key = key;
+	r.mtime = mtime;
+	r.crc = crc32_update(0, (const unsigned char*)data, len);
+	if(pwrite(pack.fd, &r, sizeof(r), (off_t)off) != sizeof(r)) return 0;
+	if(pwrite(pack.fd, data, len, (off_t)(off + sizeof(r))) != (ssize_t)len) return 0;
+	pack.end += sizeof(r) + len;
+	mtx_lock(&pack.mtx);
+	pack_insert(key, PACK_LOC(off, len), mtime);
+	mtx_unlock(&pack.mtx);
+	if(++pack.unsynced >= PACK_SYNC) pack_commit(1);
+	return 1;
+}
+
+Buf* pack_get(Loader* l, int z, int x, int y, time_t* mtime) {
+	unsigned int t = 0;
+	unsigned long long key = tile_key(z, x, y), loc = pack_lookup(key, &t);
+	size_t len = (size_t)(loc & ((1u << PACK_LEN_BITS) - 1));
+	PackRecord* r;
+	Buf* b;
+	(void)l;
+	if(!loc) return 0;
+	b = buf_get();
+	if(!buf_reserve(b, sizeof(PackRecord) + len) ||
+		pread(pack.fd, b->data, sizeof(PackRecord) + len, (off_t)(loc >> PACK_LEN_BITS)) != (ssize_t)(sizeof(PackRecord) + len)) {
+		buf_put(b);
+		return 0;
+	}
+	r = (PackRecord*)b->data;
+	if(r->magic != PACK_MAGIC || r->key != key || r->len != len) {
+		buf_put(b);
+		return 0;
+	}
+	memmove(b->data, b->data + sizeof(PackRecord), len);
+	b->size = len;
+	*mtime = (time_t)t;
+	return b;
+}
+
+int pack_has(int z, int x, int y) {
+	unsigned int t;
+	return pack_lookup(tile_key(z, x, y), &t) != 0;
+}
+
+static int cmp_loc(const void* a, const void* b) {
+	unsigned long long la = *(const unsigned long long*)a, lb = *(const unsigned long long*)b;
+	return la < lb ? -1 : la > lb;
+}
+
+// neighbour records of a ring, sorted, gaps up to PACK_AHEAD_GAP read over
+void pack_ahead(const unsigned long long* keys, int n) {
+	unsigned long long locs[16];
+	off_t off = 0, end = 0;
+	unsigned int t;
+	int i, m = 0;
+	for(i = 0; i < n && m < 16; ++i) {
+		if((locs[m] = pack_lookup(keys[i], &t)) != 0) ++m;
+	}
+	qsort(locs, m, sizeof(locs[0]), cmp_loc);
+	for(i = 0; i < m; ++i) {
+		off_t o = (off_t)(locs[i] >> PACK_LEN_BITS), e = o + (off_t)sizeof(PackRecord) + (off_t)(locs[i] & ((1u << PACK_LEN_BITS) - 1));
+		if(end && o - end <= PACK_AHEAD_GAP) {
+			if(e > end) end = e;
+			continue;
+		}
+		if(end) file_willneed(pack.fd, off, end - off);
+		off = o;
+		end = e;
+	}
+	if(end) file_willneed(pack.fd, off, end - off);
+}
+
+int pack_put(int z, int x, int y, Buf* b) {
+	return pack_append(tile_key(z, x, y), b->data, b->size, (unsigned int)time(0));
+}
+
+void pack_del(int z, int x, int y) {
+	PackSlot* s;
+	unsigned long long key = tile_key(z, x, y);
+	if(!pack.writer) return;
+	mtx_lock(&pack.mtx);
+	s = pack_slot(pack.idx, key);
+	if(s->key == key) s->loc = 0;
+	mtx_unlock(&pack.mtx);
+}
+
+void pack_scan(void (*fn)(unsigned long long key)) {
+	unsigned long long i;
+	mtx_lock(&pack.mtx);
+	for(i = 0; pack.idx && i < pack.idx->cap; ++i) {
+		if(pack.idx->slots[i].key && pack.idx->slots[i].loc) fn(pack.idx->slots[i].key);
+	}
+	mtx_unlock(&pack.mtx);
+}
+
+// writer, records past committed into the index, a torn tail is cut
+static void pack_recover() {
+	struct stat st;
+	unsigned long long off = pack.idx->committed, size, i;
+	int records = 0;
+	Buf* b = buf_get();
+	fstat(pack.fd, &st);
+	size = (unsigned long long)st.st_size;
+	while(off + sizeof(PackRecord) <= size) {
+		PackRecord r;
+		if(pread(pack.fd, &r, sizeof(r), (off_t)off) != sizeof(r) || r.magic != PACK_MAGIC) break;
+		if(off + sizeof(r) + r.len > size || !buf_reserve(b, r.len)) break;
+		if(pread(pack.fd, b->data, r.len, (off_t)(off + sizeof(r))) != (ssize_t)r.len) break;
+		if(crc32_update(0, (const unsigned char*)b->data, r.len) != r.crc) break;
+		pack_insert(r.key, PACK_LOC(off, r.len), r.mtime);
+		off += sizeof(r) + r.len;
+		++records;
+	}
+	buf_put(b);
+	if(off < size) {
+		print("pack: cut %llu torn bytes\n", size - off);
+		if(ftruncate(pack.fd, (off_t)off) != 0) print("pack: can't truncate\n");
+	}
+	for(i = 0; i < pack.idx->cap; ++i) { // slots that made it to disk before their record
+		PackSlot* s = &pack.idx->slots[i];
+		if(s->loc && (s->loc >> PACK_LEN_BITS) + sizeof(PackRecord) + (s->loc & ((1u << PACK_LEN_BITS) - 1)) > off) s->loc = 0;
+	}
+	if(records) print("pack: %d records replayed\n", records);
+	pack.end = off;
+	pack.unsynced = 1;
+	pack_commit(1);
+}
+
+int pack_open(const char* dir) {
+	char path[64];
+	sprintf(path, "%s/tiles.pack", dir);
+	sprintf(pack.idx_path, "%s/tiles.idx", dir);
+	mkpath(path);
+	mtx_init(&pack.mtx);
+	if((pack.fd = open(path, O_RDWR | O_CREAT, 0644)) < 0 && (pack.fd = open(path, O_RDONLY)) < 0) return 0;
+	pack.writer = flock(pack.fd, LOCK_EX | LOCK_NB) == 0;
+	if(!pack.writer) {
+		print("pack: %s is written by another process, reading only\n", path);
+		pack.opened = time_ms();
+		pack.idx = pack_map(pack.idx_path, 0, &pack.idx_size);
+		return 1;
+	}
+	if((pack.idx = pack_map(pack.idx_path, 1, &pack.idx_size)) == 0) { // rebuilt from the data
+		if((pack.idx = pack_idx_new(pack.idx_path, 1 << 16, &pack.idx_size)) == 0) return 0;
+		if(!pack_idx_publish(pack.idx, pack.idx_size, pack.idx_path)) return 0;
+	}
+	pack_recover();
+	return 1;
+}
+#else
+int pack_open(const char* dir) {
+	(void)dir;
+	print("pack store is not supported on this platform\n");
+	return 0;
+}
+#endif
+
+// MBTiles
+// One SQLite file, the tiles table numbers rows from the south (TMS).
+// Other GIS tools read and write it as is. Each loader has its own
+// connection and prepared statements, other threads share one under a
+// lock, the writer has its own and batches puts into transactions that
+// readers see once committed. With WAL and synchronous = NORMAL a commit
+// is cheap, no fsync, so it commits whenever the queue runs dry. A
+// -durability other than none makes it synchronous = FULL. Tiles
+// carry no time, the file's stands in until the meta log knows better.
+#define MBTILES_SYNC 1024 // puts per transaction at most
+
+typedef struct MbConn {
+	sqlite3* db;
+	sqlite3_stmt* get;
+	sqlite3_stmt* has;
+	sqlite3_stmt* put;
+	sqlite3_stmt* del;
+} MbConn;
+
+typedef struct Mbtiles {
+	char path[128];
+	int writable;
+	time_t mtime;
+	MbConn loaders[MAX_LOADERS];
+	MbConn shared;  // other threads, under mtx
+	MbConn writer;
+	mtx_t mtx;
+	int pending;    // puts in the open transaction
+} Mbtiles;
+
+Mbtiles mbstore;
+
+static int mb_prepare(MbConn* c, const char* sql, sqlite3_stmt** stmt) {
+	if(sqlite3_prepare_v2(c->db, sql, -1, stmt, 0) == SQLITE_OK) return 1;
+	print("mbtiles: %s\n", sqlite3_errmsg(c->db));
+	return 0;
+}
+
+// opens c on first use, 0 - can't
+int mb_conn(Mbtiles* mb, MbConn* c, int write) {
+	#define MB_WHERE " WHERE zoom_level = ?1 AND tile_column = ?2 AND tile_row = ?3"
+	int flags = SQLITE_OPEN_NOMUTEX | (write ? SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE : SQLITE_OPEN_READONLY);
+	if(c->db) return c->get != 0;
+	if(sqlite3_open_v2(mb->path, &c->db, flags, 0) != SQLITE_OK) {
+		print("mbtiles: can't open %s: %s\n", mb->path, sqlite3_errmsg(c->db));
+		return 0;
+	}
+	sqlite3_busy_timeout(c->db, 5000);
+	if(write && sqlite3_exec(c->db,
+		"PRAGMA journal_mode = WAL;"
+		"PRAGMA synchronous = NORMAL;"
+		"CREATE TABLE IF NOT EXISTS metadata (name text, value text);"
+		"CREATE TABLE IF NOT EXISTS tiles (zoom_level integer, tile_column integer, tile_row integer, tile_data blob);"
+		"CREATE UNIQUE INDEX IF NOT EXISTS tile_index ON tiles (zoom_level, tile_column, tile_row);",
+		0, 0, 0) != SQLITE_OK) {
+		print("mbtiles: %s: %s\n", mb->path, sqlite3_errmsg(c->db));
+		return 0;
+	}
+	if(write && save_durability != DURABLE_NONE) sqlite3_exec(c->db, "PRAGMA synchronous = FULL;", 0, 0, 0);
+	if(!mb_prepare(c, "SELECT tile_data FROM tiles" MB_WHERE, &c->get) ||
+		!mb_prepare(c, "SELECT 1 FROM tiles" MB_WHERE, &c->has)) return 0;
+	if(write && (!mb_prepare(c, "INSERT OR REPLACE INTO tiles (zoom_level, tile_column, tile_row, tile_data) VALUES (?1, ?2, ?3, ?4)", &c->put) ||
+		!mb_prepare(c, "DELETE FROM tiles" MB_WHERE, &c->del))) return 0;
+	return 1;
+	#undef MB_WHERE
+}
+
+static void mb_bind(sqlite3_stmt* stmt, int z, int x, int y) {
+	sqlite3_bind_int(stmt, 1, z);
+	sqlite3_bind_int(stmt, 2, x);
+	sqlite3_bind_int(stmt, 3, (1 << z) - 1 - y);
+}
+
+static void mb_meta(MbConn* c, const char* name, const char* value) {
+	sqlite3_stmt* stmt;
+	if(sqlite3_prepare_v2(c->db, "INSERT INTO metadata (name, value) SELECT ?1, ?2 WHERE NOT EXISTS (SELECT 1 FROM metadata WHERE name = ?1)", -1, &stmt, 0) != SQLITE_OK) return;
+	sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 2, value, -1, SQLITE_STATIC);
+	sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+}
+
+// a writable file is created with the schema and metadata if new
+int mb_open(Mbtiles* mb, const char* path, int writable) {
+	struct stat st;
+	memset(mb, 0, sizeof(Mbtiles));
+	strncpy(mb->path, path, sizeof(mb->path) - 1);
+	mb->writable = writable;
+	mtx_init(&mb->mtx);
+	if(!writable && !exists(path)) {
+		print("mbtiles: no %s\n", path);
+		return 0;
+	}
+	if(writable) {
+		if(!mb_conn(mb, &mb->writer, 1)) return 0;
+		mb_meta(&mb->writer, "name", map.name);
+		mb_meta(&mb->writer, "format", strcmp(map.imgformat, "jpeg") == 0 ? "jpg" : map.imgformat);
+		mb_meta(&mb->writer, "type", "baselayer");
+		mb_meta(&mb->writer, "version", "1.0");
+	}
+	mb->mtime = stat(path, &st) == 0 ? st.st_mtime : time(0);
+	return mb_conn(mb, &mb->shared, 0);
+}
+
+// l - on a loader, its own connection, else the shared one
+Buf* mb_get(Mbtiles* mb, Loader* l, int z, int x, int y, time_t* mtime) {
+	MbConn* c = l ? &mb->loaders[l->id] : &mb->shared;
+	Buf* b = 0;
+	if(!l) mtx_lock(&mb->mtx);
+	if(mb_conn(mb, c, 0)) {
+		mb_bind(c->get, z, x, y);
+		if(sqlite3_step(c->get) == SQLITE_ROW) {
+			const void* data = sqlite3_column_blob(c->get, 0);
+			int n = sqlite3_column_bytes(c->get, 0);
+			b = buf_get();
+			if(n <= 0 || buf_write((void*)data, 1, n, b) != (size_t)n) {
+				buf_put(b);
+				b = 0;
+			}
+		}
+		sqlite3_reset(c->get);
+	}
+	if(!l) mtx_unlock(&mb->mtx);
+	*mtime = mb->mtime;
+	return b;
+}
+
+int mb_has(Mbtiles* mb, int z, int x, int y) {
+	int found = 0;
+	mtx_lock(&mb->mtx);
+	if(mb->shared.has) {
+		mb_bind(mb->shared.has, z, x, y);
+		found = sqlite3_step(mb->shared.has) == SQLITE_ROW;
+		sqlite3_reset(mb->shared.has);
+	}
+	mtx_unlock(&mb->mtx);
+	return found;
+}
+
+void mbtiles_sync(int now) {
+	(void)now;
+	if(!mbstore.pending) return;
+	if(sqlite3_exec(mbstore.writer.db, "COMMIT", 0, 0, 0) != SQLITE_OK) print("mbtiles: %s\n", sqlite3_errmsg(mbstore.writer.db));
+	mbstore.pending = 0;
+}
+
+// writer, statements run in the open transaction
+static int mbtiles_step(sqlite3_stmt* stmt) {
+	int ok;
+	if(!mbstore.pending && sqlite3_exec(mbstore.writer.db, "BEGIN", 0, 0, 0) != SQLITE_OK) return 0;
+	++mbstore.pending;
+	ok = sqlite3_step(stmt) == SQLITE_DONE;
+	sqlite3_reset(stmt);
+	if(mbstore.pending >= MBTILES_SYNC) mbtiles_sync(1);
+	return ok;
+}
+
+Buf* mbtiles_get(Loader* l, int z, int x, int y, time_t* mtime) {
+	return mb_get(&mbstore, l, z, x, y, mtime);
+}
+
+int mbtiles_has(int z, int x, int y) {
+	return mb_has(&mbstore, z, x, y);
+}
+
+int mbtiles_put(int z, int x, int y, Buf* b) {
+	sqlite3_stmt* stmt = mbstore.writer.put;
+	if(!stmt) return 0;
+	mb_bind(stmt, z, x, y);
+	sqlite3_bind_blob(stmt, 4, b->data, (int)b->size, SQLITE_STATIC);
+	return mbtiles_step(stmt);
+}
+
+void mbtiles_del(int z, int x, int y) {
+	sqlite3_stmt* stmt = mbstore.writer.del;
+	if(!stmt) return;
+	mb_bind(stmt, z, x, y);
+	mbtiles_step(stmt);
+}
+
+void mbtiles_scan(void (*fn)(unsigned long long key)) {
+	sqlite3_stmt* stmt;
+	mtx_lock(&mbstore.mtx);
+	if(mbstore.shared.db && sqlite3_prepare_v2(mbstore.shared.db, "SELECT zoom_level, tile_column, tile_row FROM tiles", -1, &stmt, 0) == SQLITE_OK) {
+		while(sqlite3_step(stmt) == SQLITE_ROW) {
+			int z = sqlite3_column_int(stmt, 0);
+			if(z < 0 || z > 30) continue;
+			fn(tile_key(z, sqlite3_column_int(stmt, 1), (1 << z) - 1 - sqlite3_column_int(stmt, 2)));
+		}
+		sqlite3_finalize(stmt);
+	}
+	mtx_unlock(&mbstore.mtx);
+}
+
+// Archive
+// Read-only tile archive for handing a base cache to many machines,
+// glutplanet archive writes one from a cache. Tiles are ordered by zoom,
+// then along the Hilbert curve, so tiles next to each other on screen are
+// mostly next to each other in the file. The directory follows the tile
+// data: leaves of up to ARC_LEAF entries and a root with the first id of
+// each leaf, both delta coded varints. Same tiles, like empty sea, are
+// stored once. -mirror file.gpa reads one with pread,
+// -mirror http://host/file.gpa with range requests, within the mirror's
+// limits, and skipped while its breaker is open. A loader reading a
+// tile also takes the neighbours around it that wait in the load queue,
+// when their bytes are adjacent, in the same request.
+#define ARC_MAGIC "gparc1"
+#define ARC_LEAF 4096          // entries per leaf directory
+#define ARC_SPAN (512 * 1024)  // bytes in one batched read
+#define ARC_BATCH 32           // tiles in one batched read
+#define ARC_CACHE 64           // neighbours read ahead, waiting for their loader
+
+typedef struct ArcHeader {
+	char magic[8];
+	unsigned long long tiles;      // directory entries
+	unsigned long long data_len;   // tile bytes, right after the header
+	unsigned long long leaves_off; // leaf directories, one after another
+	unsigned long long root_off;
+	unsigned long long root_len;
+	unsigned long long pad[2];
+} ArcHeader;
+
+typedef struct ArcEntry {
+	unsigned long long id;  // arc_id
+	unsigned long long off; // in the file
+	unsigned int len;
+} ArcEntry;
+
+typedef struct ArcLeaf {
+	unsigned long long first; // id of the first entry
+	unsigned long long off;
+	unsigned int len;
+	int count;
+	ArcEntry* entries;        // 0 - not read yet
+} ArcLeaf;
+
+typedef struct ArcCached {
+	unsigned long long id;
+	Buf* buf;                 // 0 - free
+} ArcCached;
+
+typedef struct Archive {
+	char path[128];
+	int fd;                        // -1 - over http
+	CURL* curl[MAX_LOADERS + 1];   // one per loader, the last for other threads
+	ArcLeaf* leaves;               // 0 - unreadable
+	int leaves_count;
+	ArcCached cache[ARC_CACHE];
+	int cache_next;
+	mtx_t mtx;                     // leaves, cache, the last curl handle and src's limits
+	Source* src;                   // over http, the mirror's limits and breaker
+	int inflight;                  // range requests out
+	int reads;
+	int batched;                   // tiles that came with another tile's read
+} Archive;
+
+// position of x,y along the Hilbert curve over the 2^z grid
+unsigned long long hilbert_d(int z, unsigned int x, unsigned int y) {
+	unsigned int n = 1u << z, s, rx, ry, t;
+	unsigned long long d = 0;
+	for(s = n / 2; s > 0; s /= 2) {
+		rx = (x & s) > 0;
+		ry = (y & s) > 0;
+		d += (unsigned long long)s * s * ((3 * rx) ^ ry);
+		if(!ry) {
+			if(rx) {
+				x = n - 1 - x;
+				y = n - 1 - y;
+			}
+			t = x; x = y; y = t;
+		}
+	}
+	return d;
+}
+
+void hilbert_xy(int z, unsigned long long d, unsigned int* x, unsigned int* y) {
+	unsigned int n = 1u << z, s, rx, ry, t;
+	*x = *y = 0;
+	for(s = 1; s < n; s *= 2) {
+		rx = 1 & (unsigned int)(d / 2);
+		ry = 1 & (unsigned int)(d ^ rx);
+		if(!ry) {
+			if(rx) {
+				*x = s - 1 - *x;
+				*y = s - 1 - *y;
+			}
+			t = *x; *x = *y; *y = t;
+		}
+		*x += s * rx;
+		*y += s * ry;
+		d /= 4;
+	}
+}
+
+// tiles of lower zooms come first
+unsigned long long arc_id(int z, int x, int y) {
+	return ((1ull << 2 * z) - 1) / 3 + hilbert_d(z, (unsigned int)x, (unsigned int)y);
+}
+
+void arc_tile(unsigned long long id, Tile* t) {
+	unsigned int x, y;
+	int z = 0;
+	while(z < 30 && ((1ull << 2 * (z + 1)) - 1) / 3 <= id) ++z;
+	hilbert_xy(z, id - ((1ull << 2 * z) - 1) / 3, &x, &y);
+	tile_init(t, (int)x, (int)y, z);
+}
+
+void varint_put(Buf* b, unsigned long long v) {
+	char c[10];
+	int n = 0;
+	do {
+		c[n] = (char)(v & 127);
+		v >>= 7;
+		if(v) c[n] |= (char)128;
+		++n;
+	} while(v);
+	buf_write(c, 1, n, b);
+}
+
+unsigned long long varint_get(const unsigned char** p, const unsigned char* end) {
+	unsigned long long v = 0;
+	int shift = 0;
+	while(*p < end && shift < 64) {
+		unsigned char c = *(*p)++;
+		v |= (unsigned long long)(c & 127) << shift;
+		if(!(c & 128)) break;
+		shift += 7;
+	}
+	return v;
+}
+
+typedef struct ArcRange {
+	Buf* buf;
+	size_t max;
+} ArcRange;
+
+// a server that ignores the range would send the whole archive, cut it
+static size_t arc_write(void* ptr, size_t size, size_t nmemb, void* userp) {
+	ArcRange* r = (ArcRange*)userp;
+	if(r->buf->size + size * nmemb > r->max) return 0;
+	return buf_write(ptr, size, nmemb, r->buf);
+}
+
+// len bytes at off into b, 0 - failed
+int arc_read(Archive* a, Loader* l, unsigned long long off, size_t len, Buf* b) {
+	ArcRange r;
+	CURL* c;
+	char range[48];
+	long code = 0;
+	int ok, up, go, slot = l ? l->id : MAX_LOADERS;
+	Source* src = a->src;
+	++a->reads;
+	b->size = 0;
+	if(!buf_reserve(b, len)) return 0;
+	if(a->fd >= 0) {
+#if __linux || __APPLE__
+		if(pread(a->fd, b->data, len, (off_t)off) != (ssize_t)len) return 0;
+		b->size = len;
+		return 1;
+#else
+		return 0;
+#endif
+	}
+	// a mirror that is down or busy is skipped, not waited for
+	mtx_lock(&a->mtx);
+	go = !src || (a->inflight < src->conns && bucket_wait(&src->bucket) <= 0 && breaker_allow(&src->breaker));
+	if(go) ++a->inflight;
+	if(go && src) bucket_take(&src->bucket);
+	mtx_unlock(&a->mtx);
+	if(!go) return 0;
+	if(!l) mtx_lock(&a->mtx);
+	if(!a->curl[slot]) a->curl[slot] = curl_make_handle();
+	c = a->curl[slot];
+	r.buf = b;
+	r.max = len;
+	sprintf(range, "%llu-%llu", off, off + len - 1);
+	curl_easy_setopt(c, CURLOPT_URL, a->path);
+	curl_easy_setopt(c, CURLOPT_RANGE, range);
+	curl_easy_setopt(c, CURLOPT_WRITEFUNCTION, arc_write);
+	curl_easy_setopt(c, CURLOPT_WRITEDATA, &r);
+	curl_easy_setopt(c, CURLOPT_CONNECTTIMEOUT_MS, (long)(src ? src->connect_timeout : map.connect_timeout));
+	curl_easy_setopt(c, CURLOPT_TIMEOUT_MS, (long)map.timeout);
+	up = c && curl_easy_perform(c) == CURLE_OK;
+	ok = up && curl_easy_getinfo(c, CURLINFO_RESPONSE_CODE, &code) == CURLE_OK && code == 206 && b->size == len;
+	if(!l) mtx_unlock(&a->mtx);
+	mtx_lock(&a->mtx);
+	--a->inflight;
+	if(src) breaker_result(&src->breaker, up); // any answer means the server is there
+	mtx_unlock(&a->mtx);
+	return ok;
+}
+
+// header and root directory, leaves are read when first needed
+int arc_open(Archive* a, const char* path) {
+	ArcHeader h;
+	Buf* b = buf_get();
+	const unsigned char *p, *end;
+	unsigned long long first = 0, off;
+	int i;
+	memset(a, 0, sizeof(Archive));
+	strncpy(a->path, path, sizeof(a->path) - 1);
+	mtx_init(&a->mtx);
+	a->fd = -1;
+#if __linux || __APPLE__
+	if(strncmp(path, "http://", 7) != 0 && strncmp(path, "https://", 8) != 0 && (a->fd = open(path, O_RDONLY)) < 0) {
+		buf_put(b);
+		return 0;
+	}
+#endif
+	if(!arc_read(a, 0, 0, sizeof(h), b)) {
+		buf_put(b);
+		return 0;
+	}
+	memcpy(&h, b->data, sizeof(h));
+	if(memcmp(h.magic, ARC_MAGIC, sizeof(ARC_MAGIC)) != 0 || !arc_read(a, 0, h.root_off, (size_t)h.root_len, b)) {
+		buf_put(b);
+		return 0;
+	}
+	p = (const unsigned char*)b->data;
+	end = p + b->size;
+	a->leaves_count = (int)varint_get(&p, end);
+	a->leaves = (ArcLeaf*)calloc(a->leaves_count + 1, sizeof(ArcLeaf));
+	off = h.leaves_off;
+	for(i = 0; i < a->leaves_count; ++i) {
+		ArcLeaf* f = &a->leaves[i];
+		f->first = first += varint_get(&p, end);
+		f->len = (unsigned int)varint_get(&p, end);
+		f->count = (int)varint_get(&p, end);
+		f->off = off;
+		off += f->len;
+	}
+	buf_put(b);
+	print("archive %s: %llu tiles, %d leaves\n", path, h.tiles, a->leaves_count);
+	return 1;
+}
+
+static ArcEntry* arc_leaf_read(Archive* a, Loader* l, ArcLeaf* f) {
+	ArcEntry* e;
+	Buf* b = buf_get();
+	const unsigned char *p, *end;
+	unsigned long long id = f->first, off = 0;
+	int i;
+	if(!arc_read(a, l, f->off, f->len, b)) {
+		buf_put(b);
+		return 0;
+	}
+	e = (ArcEntry*)malloc(f->count * sizeof(ArcEntry));
+	p = (const unsigned char*)b->data;
+	end = p + b->size;
+	for(i = 0; i < f->count; ++i) e[i].id = id += varint_get(&p, end); // the first delta is 0
+	for(i = 0; i < f->count; ++i) e[i].len = (unsigned int)varint_get(&p, end);
+	for(i = 0; i < f->count; ++i) {
+		unsigned long long v = varint_get(&p, end); // 0 - right after the previous one
+		e[i].off = off = v ? v - 1 : off;
+		off += e[i].len;
+	}
+	buf_put(b);
+	return e;
+}
+
+// entries of the leaf that would hold id, 0 - none
+static ArcLeaf* arc_leaf(Archive* a, Loader* l, unsigned long long id) {
+	int lo = 0, hi = a->leaves_count - 1;
+	ArcLeaf* f;
+	ArcEntry* e;
+	if(hi < 0 || id < a->leaves[0].first) return 0;
+	while(lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if(a->leaves[mid].first <= id) lo = mid;
+		else hi = mid - 1;
+	}
+	f = &a->leaves[lo];
+	mtx_lock(&a->mtx);
+	e = f->entries;
+	mtx_unlock(&a->mtx);
+	if(e) return f;
+	if((e = arc_leaf_read(a, l, f)) == 0) return 0;
+	mtx_lock(&a->mtx);
+	if(f->entries) free(e); // another loader was first
+	else f->entries = e;
+	mtx_unlock(&a->mtx);
+	return f;
+}
+
+// under tiles_load->mtx
+static int arc_queued(unsigned long long id) {
+	Tile t;
+	arc_tile(id, &t);
+	return tile_find(tiles_load, &t) != 0;
+}
+
+static void arc_cache(Archive* a, unsigned long long id, const char* data, size_t len) {
+	ArcCached* c;
+	Buf* b = buf_get();
+	if(buf_write((void*)data, 1, len, b) != len) {
+		buf_put(b);
+		return;
+	}
+	mtx_lock(&a->mtx);
+	c = &a->cache[a->cache_next++ % ARC_CACHE];
+	if(c->buf) buf_put(c->buf);
+	c->id = id;
+	c->buf = b;
+	mtx_unlock(&a->mtx);
+}
+
+Buf* arc_get(Archive* a, Loader* l, int z, int x, int y) {
+	unsigned long long id = arc_id(z, x, y), start;
+	ArcLeaf* f;
+	ArcEntry* e;
+	Buf* b = 0;
+	int i, lo, hi, first, last;
+	mtx_lock(&a->mtx);
+	for(i = 0; i < ARC_CACHE; ++i) {
+		if(a->cache[i].buf && a->cache[i].id == id) {
+			b = a->cache[i].buf;
+			a->cache[i].buf = 0;
+			break;
+		}
+	}
+	mtx_unlock(&a->mtx);
+	if(b) return b;
+	if((f = arc_leaf(a, l, id)) == 0) return 0;
+	e = f->entries;
+	for(lo = 0, hi = f->count - 1; lo < hi;) {
+		int mid = (lo + hi) / 2;
+		if(e[mid].id < id) lo = mid + 1;
+		else hi = mid;
+	}
+	if(f->count == 0 || e[lo].id != id) return 0;
+	first = last = lo;
+	if(tiles_load) {
+		mtx_lock(&tiles_load->mtx);
+		while(last + 1 < f->count && last - first + 1 < ARC_BATCH && e[last + 1].off == e[last].off + e[last].len &&
+			e[last + 1].off + e[last + 1].len - e[first].off <= ARC_SPAN && arc_queued(e[last + 1].id)) ++last;
+		while(first > 0 && last - first + 1 < ARC_BATCH && e[first - 1].off + e[first - 1].len == e[first].off &&
+			e[last].off + e[last].len - e[first - 1].off <= ARC_SPAN && arc_queued(e[first - 1].id)) --first;
+		mtx_unlock(&tiles_load->mtx);
+	}
+	start = e[first].off;
+	b = buf_get();
+	if(!arc_read(a, l, start, (size_t)(e[last].off + e[last].len - start), b)) {
+		buf_put(b);
+		return 0;
+	}
+	for(i = first; i <= last; ++i) {
+		if(i != lo) arc_cache(a, e[i].id, b->data + (e[i].off - start), e[i].len);
+	}
+	a->batched += last - first;
+	memmove(b->data, b->data + (e[lo].off - start), e[lo].len);
+	b->size = e[lo].len;
+	return b;
+}
+
+void store_init() {
+	int i;
+	if(!dirs.init) {
+		mtx_init(&dirs.mtx);
+		dirs.init = 1;
+	}
+	store.get = files_get;
+	store.has = files_has;
+	store.put = files_put;
+	store.del = files_del;
+	store.sync = files_sync;
+	store.scan = 0;
+#if __linux || __APPLE__
+	store.ahead = files_ahead;
+#else
+	store.ahead = 0;
+#endif
+#if __linux || __APPLE__
+	if(map.store == STORE_PACK && pack_open(map.name)) {
+		store.get = pack_get;
+		store.has = pack_has;
+		store.put = pack_put;
+		store.del = pack_del;
+		store.sync = pack_commit;
+		store.scan = pack_scan;
+		store.ahead = pack_ahead;
+	}
+#else
+	if(map.store == STORE_PACK) pack_open(map.name);
+#endif
+	if(map.store == STORE_MBTILES && mb_open(&mbstore, map.mbtiles, 1)) {
+		store.get = mbtiles_get;
+		store.has = mbtiles_has;
+		store.put = mbtiles_put;
+		store.del = mbtiles_del;
+		store.sync = mbtiles_sync;
+		store.scan = mbtiles_scan;
+		store.ahead = 0; // a tile's pages are wherever SQLite put them
+	}
+	for(i = 0; i < map.sources_count; ++i) {
+		Source* s = &map.sources[i];
+		if(s->kind != SOURCE_MBTILES || s->mb) continue;
+		s->mb = (Mbtiles*)malloc(sizeof(Mbtiles));
+		if(!mb_open(s->mb, s->base, 0)) print("mirror %s is unreadable\n", s->base);
+	}
+	for(i = 0; i < map.sources_count; ++i) {
+		Source* s = &map.sources[i];
+		if(s->kind != SOURCE_ARCHIVE || s->arc) continue;
+		s->arc = (Archive*)malloc(sizeof(Archive));
+		if(!arc_open(s->arc, s->base)) print("mirror %s is unreadable\n", s->base);
+		if(s->arc->fd < 0) s->arc->src = s;
+	}
+}
+
+// 0 - another process holds the pack, every put would fail
+int store_writable() {
+#if __linux || __APPLE__
+	if(store.put == pack_put && !pack.writer) return 0;
+#endif
+	return 1;
+}
+
+// Coverage
+// Which tiles of the provider are cached: bitmaps of 8x8 tile blocks in
+// a hash table, the leaf level of a quadtree, two bits a tile where the
+// cache is dense. Read from the store when it can list itself, else from
+// <name>/coverage.idx, else built by a crawl of the cache directory with
+// one thread per few x directories, and saved. The writer keeps it up to
+// date and saves it now and then, merged with what other processes
+// saved, less the tiles removed here since the last save. Once ready, a
+// tile not in it is not looked for on disk, no stat and no open. A tile
+// written by another program is missed until glutplanet coverage
+// -rebuild, one deleted by hand costs a failed read.
+#define COVER_MAGIC "gpcov1"
+#define COVER_SAVE 10000 // ms between saves while tiles come in
+#define COVER_CRAWLERS 8
+
+typedef struct CoverBlock {
+	unsigned long long key;  // tile_key of the top left tile, 0 - empty slot
+	unsigned long long bits; // bit y%8*8 + x%8
+} CoverBlock;
+
+typedef struct Coverage {
+	CoverBlock* blocks;
+	int cap;            // a power of two
+	int count;          // blocks
+	int tiles;
+	volatile int ready; // built, a miss is a miss
+	int dirty;          // tiles came or went since the last save
+	int saving;         // a writer is saving, the others don't
+	CoverBlock* removed; // bits of tiles removed since the last save
+	int removed_cap;    // a power of two, 0 - none yet
+	int removed_count;
+	double saved;
+	mtx_t mtx;
+} Coverage;
+
+Coverage coverage;
+
+int popcount64(unsigned long long v) {
+	v = v - (v >> 1 & 0x5555555555555555ull);
+	v = (v & 0x3333333333333333ull) + (v >> 2 & 0x3333333333333333ull);
+	v = (v + (v >> 4)) & 0x0f0f0f0f0f0f0f0full;
+	return (int)(v * 0x0101010101010101ull >> 56);
+}
+
+static CoverBlock* cover_slot(CoverBlock* blocks, int cap, unsigned long long key) {
+	int i = (int)(key * 0x9e3779b97f4a7c15ull >> 32) & (cap - 1);
+	while(blocks[i].key && blocks[i].key != key) i = (i + 1) & (cap - 1);
+	return &blocks[i];
+}
+
+// under mtx
+static void cover_or(unsigned long long key, unsigned long long bits) {
+	CoverBlock* b;
+	int i;
+	if(coverage.count * 2 >= coverage.cap) {
+		CoverBlock* old = coverage.blocks;
+		int cap = coverage.cap;
+		coverage.cap *= 2;
+		coverage.blocks = (CoverBlock*)calloc(coverage.cap, sizeof(CoverBlock));
+		for(i = 0; i < cap; ++i) {
+			if(old[i].key) *cover_slot(coverage.blocks, coverage.cap, old[i].key) = old[i];
+		}
+		free(old);
+	}
+	b = cover_slot(coverage.blocks, coverage.cap, key);
+	if(!b->key) {
+		b->key = key;
+		++coverage.count;
+	}
+	coverage.tiles += popcount64(bits & ~b->bits);
+	b->bits |= bits;
+}
+
+// under mtx, key and bits into coverage.removed
+static void cover_removed(unsigned long long key, unsigned long long bits) {
+	CoverBlock* b;
+	int i;
+	if(coverage.removed_count * 2 >= coverage.removed_cap) {
+		CoverBlock* old = coverage.removed;
+		int cap = coverage.removed_cap;
+		coverage.removed_cap = cap ? cap * 2 : 256;
+		coverage.removed = (CoverBlock*)calloc(coverage.removed_cap, sizeof(CoverBlock));
+		for(i = 0; i < cap; ++i) {
+			if(old[i].key) *cover_slot(coverage.removed, coverage.removed_cap, old[i].key) = old[i];
+		}
+		free(old);
+	}
+	b = cover_slot(coverage.removed, coverage.removed_cap, key);
+	if(!b->key) {
+		b->key = key;
+		++coverage.removed_count;
+	}
+	b->bits |= bits;
+}
+
+// under mtx
+static void coverage_insert(unsigned long long key) {
+	int z = (int)(key >> 58 & 31), x = (int)(key >> 29 & 0x1fffffff), y = (int)(key & 0x1fffffff);
+	cover_or(tile_key(z, x & ~7, y & ~7), 1ull << ((y & 7) * 8 + (x & 7)));
+}
+
+static void coverage_locked(unsigned long long key) {
+	mtx_lock(&coverage.mtx);
+	coverage_insert(key);
+	mtx_unlock(&coverage.mtx);
+}
+
+int coverage_has(int z, int x, int y) {
+	CoverBlock* b;
+	int has;
+	mtx_lock(&coverage.mtx);
+	b = cover_slot(coverage.blocks, coverage.cap, tile_key(z, x & ~7, y & ~7));
+	has = b->key && (b->bits >> ((y & 7) * 8 + (x & 7)) & 1);
+	mtx_unlock(&coverage.mtx);
+	return has;
+}
+
+// a tile was stored
+void coverage_add(int z, int x, int y) {
+	if(!coverage.blocks) return;
+	mtx_lock(&coverage.mtx);
+	if(coverage.removed_cap) { // stored again
+		CoverBlock* r = cover_slot(coverage.removed, coverage.removed_cap, tile_key(z, x & ~7, y & ~7));
+		if(r->key) r->bits &= ~(1ull << ((y & 7) * 8 + (x & 7)));
+	}
+	coverage_insert(tile_key(z, x, y));
+	coverage.dirty = 1;
+	mtx_unlock(&coverage.mtx);
+}
+
+// a tile was removed
+void coverage_del(int z, int x, int y) {
+	CoverBlock* b;
+	unsigned long long bit = 1ull << ((y & 7) * 8 + (x & 7));
+	if(!coverage.blocks) return;
+	mtx_lock(&coverage.mtx);
+	b = cover_slot(coverage.blocks, coverage.cap, tile_key(z, x & ~7, y & ~7));
+	if(b->key && (b->bits & bit)) {
+		b->bits &= ~bit;
+		--coverage.tiles;
+	}
+	cover_removed(tile_key(z, x & ~7, y & ~7), bit); // coverage.idx may still have it
+	coverage.dirty = 1;
+	mtx_unlock(&coverage.mtx);
+}
+
+// tiles of block b in x0..x1, y0..y1
+static int cover_in(const CoverBlock* b, int x0, int y0, int x1, int y1) {
+	int bx = (int)(b->key >> 29 & 0x1fffffff), by = (int)(b->key & 0x1fffffff), c, r, n = 0;
+	for(r = 0; r < 8; ++r) {
+		if(by + r < y0 || by + r > y1) continue;
+		for(c = 0; c < 8; ++c) n += bx + c >= x0 && bx + c <= x1 && (b->bits >> (r * 8 + c) & 1);
+	}
+	return n;
+}
+
+// cached tiles in x0..x1, y0..y1 of zoom z
+int coverage_count(int z, int x0, int y0, int x1, int y1) {
+	int i, n = 0, bx, by;
+	double blocks = ((double)(x1 / 8) - x0 / 8 + 1) * ((double)(y1 / 8) - y0 / 8 + 1);
+	mtx_lock(&coverage.mtx);
+	if(blocks > coverage.count) { // fewer blocks in the table than in the rect
+		for(i = 0; i < coverage.cap; ++i) {
+			CoverBlock* b = &coverage.blocks[i];
+			if(b->key && (int)(b->key >> 58 & 31) == z) n += cover_in(b, x0, y0, x1, y1);
+		}
+	} else {
+		for(by = y0 & ~7; by <= y1; by += 8) {
+			for(bx = x0 & ~7; bx <= x1; bx += 8) {
+				CoverBlock* b = cover_slot(coverage.blocks, coverage.cap, tile_key(z, bx, by));
+				if(b->key) n += cover_in(b, x0, y0, x1, y1);
+			}
+		}
+	}
+	mtx_unlock(&coverage.mtx);
+	return n;
+}
+
+// every cached tile, tile keys
+unsigned long long* coverage_list(int* n) {
+	unsigned long long* keys;
+	int i, k;
+	mtx_lock(&coverage.mtx);
+	keys = (unsigned long long*)malloc((coverage.tiles + 1) * sizeof(unsigned long long));
+	*n = 0;
+	for(i = 0; i < coverage.cap; ++i) {
+		CoverBlock* b = &coverage.blocks[i];
+		if(!b->key) continue;
+		for(k = 0; k < 64 && *n < coverage.tiles; ++k) {
+			if(b->bits >> k & 1) keys[(*n)++] = b->key + ((unsigned long long)(k & 7) << 29) + (k >> 3);
+		}
+	}
+	mtx_unlock(&coverage.mtx);
+	return keys;
+}
+
+// blocks saved in path, 0 - none or not an index
+static CoverBlock* cover_read(const char* path, int* n) {
+	char magic[8];
+	unsigned long long count = 0;
+	CoverBlock* blocks;
+	FILE* f = fopen(path, "rb");
+	*n = 0;
+	if(!f) return 0;
+	if(fread(magic, sizeof(magic), 1, f) != 1 || memcmp(magic, COVER_MAGIC, sizeof(COVER_MAGIC)) != 0 ||
+		fread(&count, sizeof(count), 1, f) != 1 || count > 1u << 30) {
+		fclose(f);
+		return 0;
+	}
+	blocks = (CoverBlock*)malloc((size_t)(count + 1) * sizeof(CoverBlock));
+	*n = (int)fread(blocks, sizeof(CoverBlock), (size_t)count, f);
+	fclose(f);
+	if(*n != (int)count) {
+		free(blocks);
+		*n = 0;
+		return 0;
+	}
+	return blocks;
+}
+
+// merge - or with what the file has now, tiles other processes stored
+void coverage_save(const char* dir, int merge) {
+	char path[64], tmp[68];
+	CoverBlock *old = 0, *blocks, *removed;
+	unsigned long long count = 0;
+	int i, n = 0, removed_cap, ok = 0;
+	FILE* f;
+	sprintf(path, "%s/coverage.idx", dir);
+	sprintf(tmp, "%s.tmp", path);
+	if(merge) old = cover_read(path, &n);
+	mtx_lock(&coverage.mtx);
+	for(i = 0; i < n; ++i) {
+		unsigned long long bits = old[i].bits;
+		if(coverage.removed_cap) {
+			CoverBlock* r = cover_slot(coverage.removed, coverage.removed_cap, old[i].key);
+			if(r->key) bits &= ~r->bits;
+		}
+		if(bits) cover_or(old[i].key, bits);
+	}
+	blocks = (CoverBlock*)malloc((coverage.count + 1) * sizeof(CoverBlock));
+	for(i = 0; i < coverage.cap; ++i) {
+		if(coverage.blocks[i].key && coverage.blocks[i].bits) blocks[count++] = coverage.blocks[i];
+	}
+	removed = coverage.removed; // in the file from now on, by leaving them out
+	removed_cap = coverage.removed_cap;
+	coverage.removed = 0;
+	coverage.removed_cap = coverage.removed_count = 0;
+	coverage.dirty = 0;
+	coverage.saved = time_ms();
+	mtx_unlock(&coverage.mtx);
+	free(old);
+	mkpath(path);
+	if((f = fopen(tmp, "wb")) != 0) {
+		ok = fwrite(COVER_MAGIC "\0", 8, 1, f) == 1 && fwrite(&count, sizeof(count), 1, f) == 1 &&
+			fwrite(blocks, sizeof(CoverBlock), (size_t)count, f) == count;
+		if(fclose(f) != 0 || !ok || rename(tmp, path) != 0) {
+			remove(tmp);
+			ok = 0;
+		}
+	}
+	if(!ok) {
+		print("coverage: can't save %s\n", path);
+		mtx_lock(&coverage.mtx); // the old file still has them
+		for(i = 0; i < removed_cap; ++i) {
+			if(removed[i].key) cover_removed(removed[i].key, removed[i].bits);
+		}
+		coverage.dirty = 1;
+		mtx_unlock(&coverage.mtx);
+	}
+	free(removed);
+	free(blocks);
+}
+
+// writer, when idle. now - a sync job, the process may exit after it, so
+// the index is waited for and saved
+void coverage_sync(int now) {
+	int saving;
+	while(now && coverage.blocks && !coverage.ready) sleep_ms(10);
+	if(!coverage.ready || !coverage.dirty || store.scan || (!now && time_ms() - coverage.saved < COVER_SAVE)) return;
+	mtx_lock(&coverage.mtx);
+	saving = coverage.saving;
+	coverage.saving = 1;
+	mtx_unlock(&coverage.mtx);
+	if(saving) return;
+	coverage_save(map.name, 1);
+	mtx_lock(&coverage.mtx);
+	coverage.saving = 0;
+	mtx_unlock(&coverage.mtx);
+}
+
+#if _WIN32
+// z/x/y.ext files under path
+static void coverage_dir(const char* path, int* num, int depth) {
+	DIR* dir;
+	struct dirent* ent;
+	char sub[256];
+	if((dir = opendir(path)) == 0) return;
+	while((ent = readdir(dir)) != 0) {
+		char* end;
+		long n = strtol(ent->d_name, &end, 10);
+		if(end == ent->d_name || n < 0) continue;
+		num[depth] = (int)n;
+		if(depth < 2) {
+			if(*end) continue;
+			snprintf(sub, sizeof(sub), "%s/%s", path, ent->d_name);
+			coverage_dir(sub, num, depth + 1);
+		} else if(*end == '.' && strcmp(end + 1, map.imgformat) == 0) {
+			coverage_locked(tile_key(num[0], num[1], num[2]));
+		}
+	}
+	closedir(dir);
+}
+
+void coverage_crawl(const char* dir) {
+	int num[3];
+	coverage_dir(dir, num, 0);
+}
+#elif __linux
+typedef struct Dirent64 {
+	unsigned long long ino;
+	long long off;
+	unsigned short reclen;
+	unsigned char type;
+	char name[1];
+} Dirent64;
+
+typedef struct Crawl {
+	const char* dir;
+	int* zx;         // z, x of every x directory
+	int count;
+	int cap;
+	int next;        // under coverage.mtx
+	int running;
+} Crawl;
+
+Crawl crawl;
+
+// fn for every entry of path that starts with a number, the rest of the name after it
+static int dir_each(const char* path, void (*fn)(long n, const char* rest, void* arg), void* arg) {
+	char buf[32 * 1024];
+	int fd = open(path, O_RDONLY | O_DIRECTORY), n, i;
+	if(fd < 0) return 0;
+	while((n = (int)syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+		for(i = 0; i < n; i += ((Dirent64*)(buf + i))->reclen) {
+			const char* name = ((Dirent64*)(buf + i))->name;
+			char* end;
+			long v = strtol(name, &end, 10);
+			if(end != name && v >= 0) fn(v, end, arg);
+		}
+	}
+	close(fd);
+	return 1;
+}
+
+static void crawl_x(long x, const char* rest, void* arg) {
+	if(*rest) return;
+	if(crawl.count == crawl.cap) {
+		crawl.cap = crawl.cap ? crawl.cap * 2 : 1024;
+		crawl.zx = (int*)realloc(crawl.zx, crawl.cap * 2 * sizeof(int));
+	}
+	crawl.zx[crawl.count * 2] = *(int*)arg;
+	crawl.zx[crawl.count++ * 2 + 1] = (int)x;
+}
+
+static void crawl_z(long z, const char* rest, void* arg) {
+	char path[64];
+	int iz = (int)z;
+	(void)arg;
+	if(*rest || z > 30) return;
+	snprintf(path, sizeof(path), "%s/%ld", crawl.dir, z);
+	dir_each(path, crawl_x, &iz);
+}
+
+typedef struct CrawlDir {
+	int z, x, n, cap;
+	unsigned long long* keys;
+} CrawlDir;
+
+static void crawl_y(long y, const char* rest, void* arg) {
+	CrawlDir* d = (CrawlDir*)arg;
+	if(*rest != '.' || strcmp(rest + 1, map.imgformat) != 0) return;
+	if(d->n == d->cap) {
+		d->cap = d->cap ? d->cap * 2 : 256;
+		d->keys = (unsigned long long*)realloc(d->keys, d->cap * sizeof(unsigned long long));
+	}
+	d->keys[d->n++] = tile_key(d->z, d->x, (int)y);
+}
+
+static void* worker_crawl(void* param){
+	CrawlDir d;
+	(void)param;
+	memset(&d, 0, sizeof(d));
+	while(1) {
+		char path[64];
+		int i, k;
+		mtx_lock(&coverage.mtx);
+		i = crawl.next++;
+		mtx_unlock(&coverage.mtx);
+		if(i >= crawl.count) break;
+		d.z = crawl.zx[i * 2];
+		d.x = crawl.zx[i * 2 + 1];
+		d.n = 0;
+		snprintf(path, sizeof(path), "%s/%d/%d", crawl.dir, d.z, d.x);
+		dir_each(path, crawl_y, &d);
+		mtx_lock(&coverage.mtx);
+		for(k = 0; k < d.n; ++k) coverage_insert(d.keys[k]);
+		mtx_unlock(&coverage.mtx);
+	}
+	free(d.keys);
+	mtx_lock(&coverage.mtx);
+	--crawl.running;
+	mtx_unlock(&coverage.mtx);
+	return 0;
+}
+
+// z and x directories here, the tiles in them by COVER_CRAWLERS threads
+void coverage_crawl(const char* dir) {
+	int i, running;
+	memset(&crawl, 0, sizeof(crawl));
+	crawl.dir = dir;
+	dir_each(dir, crawl_z, 0);
+	running = crawl.running = mini(COVER_CRAWLERS, crawl.count);
+	for(i = 0; i < running; ++i) StartThread(worker_crawl, 0);
+	do {
+		sleep_ms(1);
+		mtx_lock(&coverage.mtx);
+		running = crawl.running;
+		mtx_unlock(&coverage.mtx);
+	} while(running > 0);
+	free(crawl.zx);
+}
+#else
+static int coverage_file(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+	char ext[8];
+	int z, x, y;
+	(void)st;
+	if(type == FTW_F && ftw->level == 3 && sscanf(path + strlen(map.name), "/%d/%d/%d.%7s", &z, &x, &y, ext) == 4
+		&& strcmp(ext, map.imgformat) == 0) {
+		coverage_locked(tile_key(z, x, y));
+	}
+	return 0;
+}
+
+void coverage_crawl(const char* dir) {
+	nftw(dir, coverage_file, 16, FTW_PHYS);
+}
+#endif
+
+// mtime of path in ns, 0 - no such path
+static long long path_mtime(const char* path) {
+	struct stat st;
+	if(stat(path, &st) != 0) return 0;
+#if __linux
+	return (long long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#elif __APPLE__
+	return (long long)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+	return (long long)st.st_mtime * 1000000000;
+#endif
+}
+
+// a tile was written or removed after t, by a process that did not save
+// coverage.idx: an x directory of dir changed since. Listing z and x
+// directories is cheap next to listing the tiles in them
+#if _WIN32
+static int coverage_stale(const char* dir, long long t) {
+	DIR *zd, *xd;
+	struct dirent *z, *x;
+	char path[256], sub[256];
+	int stale = 0;
+	if((zd = opendir(dir)) == 0) return 0;
+	while(!stale && (z = readdir(zd)) != 0) {
+		if(!isdigit((unsigned char)z->d_name[0])) continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, z->d_name);
+		if((xd = opendir(path)) == 0) continue;
+		while(!stale && (x = readdir(xd)) != 0) {
+			if(!isdigit((unsigned char)x->d_name[0])) continue;
+			snprintf(sub, sizeof(sub), "%s/%s", path, x->d_name);
+			stale = path_mtime(sub) > t;
+		}
+		closedir(xd);
+	}
+	closedir(zd);
+	return stale;
+}
+#elif __linux
+typedef struct Stale {
+	const char* dir;
+	long long t;
+	int z;
+	int stale;
+} Stale;
+
+static void stale_x(long x, const char* rest, void* arg) {
+	Stale* s = (Stale*)arg;
+	char path[64];
+	if(*rest || s->stale) return;
+	snprintf(path, sizeof(path), "%s/%d/%ld", s->dir, s->z, x);
+	s->stale = path_mtime(path) > s->t;
+}
+
+static void stale_z(long z, const char* rest, void* arg) {
+	Stale* s = (Stale*)arg;
+	char path[64];
+	if(*rest || z > 30 || s->stale) return;
+	s->z = (int)z;
+	snprintf(path, sizeof(path), "%s/%ld", s->dir, z);
+	dir_each(path, stale_x, s);
+}
+
+static int coverage_stale(const char* dir, long long t) {
+	Stale s;
+	s.dir = dir;
+	s.t = t;
+	s.z = 0;
+	s.stale = 0;
+	dir_each(dir, stale_z, &s);
+	return s.stale;
+}
+#else
+static long long stale_since;
+
+// nftw stops at the first changed directory, or walks the tiles too
+static int stale_entry(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+	(void)st;
+	return type == FTW_D && ftw->level == 2 && path_mtime(path) > stale_since;
+}
+
+static int coverage_stale(const char* dir, long long t) {
+	stale_since = t;
+	return nftw(dir, stale_entry, 16, FTW_PHYS) > 0;
+}
+#endif
+
+void coverage_init() {
+	mtx_init(&coverage.mtx);
+	coverage.cap = 4096;
+	coverage.blocks = (CoverBlock*)calloc(coverage.cap, sizeof(CoverBlock));
+}
+
+// crawl - don't trust coverage.idx, look at the files
+void coverage_build(const char* dir, int crawl) {
+	char path[64];
+	double start = time_ms();
+	CoverBlock* saved = 0;
+	const char* from = "from the store";
+	int i, n = 0, stale = 0;
+	sprintf(path, "%s/coverage.idx", dir);
+	// another process stored tiles after the index was saved, or removed some
+	if(!store.scan && !crawl && (saved = cover_read(path, &n)) != 0 && (stale = coverage_stale(dir, path_mtime(path))) != 0) {
+		free(saved);
+		saved = 0;
+	}
+	if(store.scan) store.scan(coverage_locked);
+	else if(saved) {
+		mtx_lock(&coverage.mtx);
+		for(i = 0; i < n; ++i) cover_or(saved[i].key, saved[i].bits);
+		mtx_unlock(&coverage.mtx);
+		free(saved);
+		from = "from coverage.idx";
+	} else {
+		coverage_crawl(dir);
+		coverage_save(dir, 0);
+		from = stale ? "crawled, coverage.idx was stale" : "crawled";
+	}
+	coverage.ready = 1;
+	print("coverage: %d tiles in %d blocks, %s in %.0f ms\n", coverage.tiles, coverage.count, from, time_ms() - start);
+}
+
+#if _WIN32
+static DWORD WINAPI worker_coverage(void* param){
+#elif __linux || __APPLE__
+static void* worker_coverage(void* param){
+#endif
+	(void)param;
+	coverage_build(map.name, 0);
+	return 0;
+}
+
+// in every process that saves tiles, else coverage_add has no table to
+// add to and coverage.idx misses what the process stored
+void coverage_start() {
+	if(coverage.blocks) return; // the caller builds it
+	coverage_init();
+	StartThread(worker_coverage, 0);
+}
+
+// Quota
+// -quota MB caps the tiles the provider keeps on disk. When and how big
+// every cached tile is lives in a hash table of our own, read from
+// <name>/tiles.lru and saved now and then merged with what other
+// processes saved, the file system's atime is not trusted. Loads from
+// disk and saves touch it. Over the quota a thread with idle I/O priority
+// removes the least recently used tiles until the cache is at LRU_LOW of
+// it, and backs off while tiles wait to be loaded. Zooms up to -pin-zoom
+// and tiles a seed covered are never removed. Sizes are rounded to 4 KB
+// blocks in the file layout. MBTiles reuses the pages it frees, the file
+// stays at its largest. -store pack is refused with it: removed records
+// stay as garbage and new ones are appended, tiles.pack would grow past
+// any quota.
+#define LRU_MAGIC "gplru1"
+#define LRU_PINNED 0x80000000u // in size, a seed wants the tile
+#define LRU_SAVE 60000         // ms between saves while tiles are used
+#define LRU_CHECK 5000         // ms between looks at the quota
+#define LRU_LOW 0.9
+
+#if __linux || __APPLE__
+#include <sys/resource.h>
+#endif
+
+typedef struct LruEntry {
+	unsigned long long key; // tile_key, 0 - empty slot
+	unsigned int used;      // unix time of the last load or save
+	unsigned int size;      // bytes on disk, 0 - not known yet
+} LruEntry;
+
+typedef struct Lru {
+	LruEntry* e;
+	int cap;      // a power of two
+	int count;
+	double bytes; // sum of the sizes
+	int dirty;
+	int saving;
+	double saved;
+	mtx_t mtx;
+} Lru;
+
+Lru lru;
+
+void store_remove(int z, int x, int y);
+
+static int lru_hash(unsigned long long key, int cap) {
+	return (int)(key * 0x9e3779b97f4a7c15ull >> 32) & (cap - 1);
+}
+
+static LruEntry* lru_slot(LruEntry* e, int cap, unsigned long long key) {
+	int i = lru_hash(key, cap);
+	while(e[i].key && e[i].key != key) i = (i + 1) & (cap - 1);
+	return &e[i];
+}
+
+// under mtx, made if new
+static LruEntry* lru_entry(unsigned long long key) {
+	LruEntry* e;
+	int i;
+	if(lru.count * 2 >= lru.cap) {
+		LruEntry* old = lru.e;
+		int cap = lru.cap;
+		lru.cap *= 2;
+		lru.e = (LruEntry*)calloc(lru.cap, sizeof(LruEntry));
+		for(i = 0; i < cap; ++i) {
+			if(old[i].key) *lru_slot(lru.e, lru.cap, old[i].key) = old[i];
+		}
+		free(old);
+	}
+	e = lru_slot(lru.e, lru.cap, key);
+	if(!e->key) {
+		e->key = key;
+		e->used = 0;
+		e->size = 0;
+		++lru.count;
+	}
+	return e;
+}
+
+// under mtx, keeps the pin
+static void lru_size(LruEntry* e, unsigned int size) {
+	lru.bytes += (double)size - (e->size & ~LRU_PINNED);
+	e->size = (e->size & LRU_PINNED) | size;
+}
+
+// under mtx, entries after e in its run move up, no tombstones
+static void lru_remove(LruEntry* e) {
+	int i = (int)(e - lru.e), j = i;
+	lru.bytes -= e->size & ~LRU_PINNED;
+	--lru.count;
+	while(1) {
+		int h;
+		j = (j + 1) & (lru.cap - 1);
+		if(!lru.e[j].key) break;
+		h = lru_hash(lru.e[j].key, lru.cap);
+		if(i <= j ? i < h && h <= j : i < h || h <= j) continue; // home is past the hole
+		lru.e[i] = lru.e[j];
+		i = j;
+	}
+	lru.e[i].key = 0;
+}
+
+// a tile was loaded from disk
+void lru_touch(int z, int x, int y) {
+	LruEntry* e;
+	unsigned int now = (unsigned int)time(0);
+	if(!lru.e) return;
+	mtx_lock(&lru.mtx);
+	e = lru_slot(lru.e, lru.cap, tile_key(z, x, y));
+	if(e->key && e->used != now) {
+		e->used = now;
+		lru.dirty = 1;
+	}
+	mtx_unlock(&lru.mtx);
+}
+
+// writer, a tile was stored
+void lru_put(int z, int x, int y, size_t size) {
+	LruEntry* e;
+	if(!lru.e) return;
+	if(store.put == files_put) size = (size + 4095) & ~(size_t)4095;
+	mtx_lock(&lru.mtx);
+	e = lru_entry(tile_key(z, x, y));
+	e->used = (unsigned int)time(0);
+	lru_size(e, (unsigned int)mini(size, ~LRU_PINNED));
+	lru.dirty = 1;
+	mtx_unlock(&lru.mtx);
+}
+
+// a seed wants the tile, it stays whatever the quota
+void lru_pin(unsigned long long key) {
+	LruEntry* e;
+	if(!lru.e) return;
+	mtx_lock(&lru.mtx);
+	e = lru_entry(key);
+	if(!(e->size & LRU_PINNED)) {
+		e->size |= LRU_PINNED;
+		lru.dirty = 1;
+	}
+	mtx_unlock(&lru.mtx);
+}
+
+// a tile was removed
+void lru_del(int z, int x, int y) {
+	LruEntry* e;
+	if(!lru.e) return;
+	mtx_lock(&lru.mtx);
+	e = lru_slot(lru.e, lru.cap, tile_key(z, x, y));
+	if(e->key) {
+		lru_remove(e);
+		lru.dirty = 1;
+	}
+	mtx_unlock(&lru.mtx);
+}
+
+// entries saved in path, 0 - none or not an index
+static LruEntry* lru_read(const char* path, int* n) {
+	char magic[8];
+	unsigned long long count = 0;
+	LruEntry* e;
+	FILE* f = fopen(path, "rb");
+	*n = 0;
+	if(!f) return 0;
+	if(fread(magic, sizeof(magic), 1, f) != 1 || memcmp(magic, LRU_MAGIC, sizeof(LRU_MAGIC)) != 0 ||
+		fread(&count, sizeof(count), 1, f) != 1 || count > 1u << 30) {
+		fclose(f);
+		return 0;
+	}
+	e = (LruEntry*)malloc((size_t)(count + 1) * sizeof(LruEntry));
+	*n = (int)fread(e, sizeof(LruEntry), (size_t)count, f);
+	fclose(f);
+	if(*n != (int)count) {
+		free(e);
+		*n = 0;
+		return 0;
+	}
+	return e;
+}
+
+// merged with the file: the later use and the pins win, tiles only the
+// file knows are taken when they are on disk
+void lru_save(const char* dir) {
+	char path[64], tmp[68];
+	LruEntry *old, *e;
+	unsigned long long count = 0;
+	int i, n = 0, m = 0;
+	FILE* f;
+	sprintf(path, "%s/tiles.lru", dir);
+	sprintf(tmp, "%s.tmp", path);
+	old = lru_read(path, &n);
+	mtx_lock(&lru.mtx);
+	for(i = 0; i < n; ++i) {
+		e = lru_slot(lru.e, lru.cap, old[i].key);
+		if(!e->key) old[m++] = old[i];
+		else {
+			if(old[i].used > e->used) e->used = old[i].used;
+			e->size |= old[i].size & LRU_PINNED;
+		}
+	}
+	mtx_unlock(&lru.mtx);
+	for(i = 0; i < m; ++i) {
+		Tile t;
+		key_tile(old[i].key, &t);
+		if(!store.has(t.z, t.x, t.y)) continue;
+		mtx_lock(&lru.mtx);
+		e = lru_entry(old[i].key);
+		if(!e->used) {
+			e->used = old[i].used;
+			lru_size(e, old[i].size & ~LRU_PINNED);
+		}
+		e->size |= old[i].size & LRU_PINNED;
+		mtx_unlock(&lru.mtx);
+	}
+	free(old);
+	mtx_lock(&lru.mtx);
+	e = (LruEntry*)malloc((lru.count + 1) * sizeof(LruEntry));
+	for(i = 0; i < lru.cap; ++i) {
+		if(lru.e[i].key) e[count++] = lru.e[i];
+	}
+	lru.dirty = 0;
+	lru.saved = time_ms();
+	mtx_unlock(&lru.mtx);
+	mkpath(path);
+	if((f = fopen(tmp, "wb")) != 0) {
+		int ok = fwrite(LRU_MAGIC "\0", 8, 1, f) == 1 && fwrite(&count, sizeof(count), 1, f) == 1 &&
+			fwrite(e, sizeof(LruEntry), (size_t)count, f) == count;
+		if(fclose(f) != 0 || !ok || rename(tmp, path) != 0) {
+			print("quota: can't save %s\n", path);
+			remove(tmp);
+		}
+	}
+	free(e);
+}
+
+// writer when idle, the evictor
+void lru_sync(int now) {
+	int saving;
+	if(!lru.e || !lru.dirty || (!now && time_ms() - lru.saved < LRU_SAVE)) return;
+	mtx_lock(&lru.mtx);
+	saving = lru.saving;
+	lru.saving = 1;
+	mtx_unlock(&lru.mtx);
+	if(saving) return;
+	lru_save(map.name);
+	mtx_lock(&lru.mtx);
+	lru.saving = 0;
+	mtx_unlock(&lru.mtx);
+}
+
+void lru_init(const char* dir) {
+	char path[64];
+	LruEntry* saved;
+	int i, n;
+	mtx_init(&lru.mtx);
+	lru.cap = 4096;
+	lru.e = (LruEntry*)calloc(lru.cap, sizeof(LruEntry));
+	lru.saved = time_ms();
+	sprintf(path, "%s/tiles.lru", dir);
+	if((saved = lru_read(path, &n)) == 0) return;
+	mtx_lock(&lru.mtx);
+	for(i = 0; i < n; ++i) {
+		LruEntry* e = lru_entry(saved[i].key);
+		e->used = saved[i].used;
+		lru_size(e, saved[i].size & ~LRU_PINNED);
+		e->size |= saved[i].size & LRU_PINNED;
+	}
+	mtx_unlock(&lru.mtx);
+	free(saved);
+}
+
+// cached tiles the index does not know the size of, from before it or
+// pinned before they came, are measured once. Their time is the file's.
+static void lru_fill() {
+	unsigned long long* keys;
+	int i, n, filled = 0;
+	double start = time_ms();
+	keys = coverage_list(&n);
+	for(i = 0; i < n; ++i) {
+		LruEntry* e;
+		Tile t;
+		time_t mtime = 0;
+		size_t size = 0;
+		int known;
+		mtx_lock(&lru.mtx);
+		e = lru_slot(lru.e, lru.cap, keys[i]);
+		known = e->key && (e->size & ~LRU_PINNED);
+		mtx_unlock(&lru.mtx);
+		if(known) continue;
+		key_tile(keys[i], &t);
+		if(store.put == files_put) {
+			char filename[64];
+			struct stat st;
+			tile_filename(t.z, t.x, t.y, filename);
+			if(stat(filename, &st) != 0) continue;
+			size = ((size_t)st.st_size + 4095) & ~(size_t)4095;
+			mtime = st.st_mtime;
+		} else {
+			Buf* b = store.get(0, t.z, t.x, t.y, &mtime);
+			if(!b) continue;
+			size = b->size;
+			buf_put(b);
+		}
+		mtx_lock(&lru.mtx);
+		e = lru_entry(keys[i]);
+		if(!(e->size & ~LRU_PINNED)) lru_size(e, (unsigned int)mini(size, ~LRU_PINNED));
+		if(!e->used) e->used = (unsigned int)mtime;
+		lru.dirty = 1;
+		mtx_unlock(&lru.mtx);
+		++filled;
+	}
+	free(keys);
+	if(filled) print("quota: measured %d tiles in %.0f ms\n", filled, time_ms() - start);
+}
+
+// this thread gets the disk and the cpu when nobody else wants them
+static void evict_priority() {
+#if _WIN32
+	SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+#elif __linux
+	syscall(SYS_ioprio_set, 1, 0, 3 << 13); // IOPRIO_WHO_PROCESS, this thread, IOPRIO_CLASS_IDLE
+	setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+#elif __APPLE__
+	setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD, IOPOL_THROTTLE);
+#endif
+}
+
+// while the loaders have work the user is looking at the map
+static void evict_yield() {
+	int busy;
+	do {
+		mtx_lock(&tiles_load->mtx);
+		busy = tiles_load->count > 0;
+		mtx_unlock(&tiles_load->mtx);
+		if(busy) sleep_ms(100);
+	} while(busy);
+}
+
+static int lru_cmp(const void* a, const void* b) {
+	unsigned int ua = ((const LruEntry*)a)->used, ub = ((const LruEntry*)b)->used;
+	return ua < ub ? -1 : ua > ub;
+}
+
+// least recently used tiles off the disk until the cache is at LRU_LOW of the quota
+static void lru_evict() {
+	LruEntry* c;
+	int i, n = 0, removed = 0;
+	double start = time_ms(), before, low = map.quota * LRU_LOW, freed = 0;
+	mtx_lock(&lru.mtx);
+	before = lru.bytes;
+	c = (LruEntry*)malloc((lru.count + 1) * sizeof(LruEntry));
+	for(i = 0; i < lru.cap; ++i) {
+		LruEntry* e = &lru.e[i];
+		if(e->key && !(e->size & LRU_PINNED) && e->size && (int)(e->key >> 58 & 31) > map.pin_zoom) c[n++] = *e;
+	}
+	mtx_unlock(&lru.mtx);
+	qsort(c, n, sizeof(LruEntry), lru_cmp);
+	for(i = 0; i < n; ++i) {
+		LruEntry* e;
+		Tile t;
+		int gone = 0, done;
+		mtx_lock(&lru.mtx);
+		done = lru.bytes <= low;
+		e = lru_slot(lru.e, lru.cap, c[i].key);
+		if(!done && e->key && e->used == c[i].used && !(e->size & LRU_PINNED)) { // not used since
+			freed += e->size;
+			lru_remove(e);
+			lru.dirty = 1;
+			gone = 1;
+		}
+		mtx_unlock(&lru.mtx);
+		if(done) break;
+		if(!gone) continue;
+		key_tile(c[i].key, &t);
+		coverage_del(t.z, t.x, t.y);
+		store_remove(t.z, t.x, t.y);
+		if(++removed % 64 == 0 && tiles_load) evict_yield();
+	}
+	free(c);
+	print("quota: %.1f MB over %.1f MB, removed %d tiles, %.1f MB in %.0f ms\n", (before - map.quota) / (1024 * 1024),
+		map.quota / (1024 * 1024), removed, freed / (1024 * 1024), time_ms() - start);
+}
+
+#if _WIN32
+static DWORD WINAPI worker_evict(void* param){
+#elif __linux || __APPLE__
+static void* worker_evict(void* param){
+#endif
+	double stuck = 0; // over the quota with nothing left to remove, pinned tiles
+	(void)param;
+	evict_priority();
+	while(!coverage.ready) sleep_ms(100);
+	lru_fill();
+	while(1) {
+		int over;
+		mtx_lock(&lru.mtx);
+		over = lru.bytes > map.quota && lru.bytes > stuck;
+		mtx_unlock(&lru.mtx);
+		if(over) {
+			lru_evict();
+			mtx_lock(&lru.mtx);
+			stuck = lru.bytes > map.quota ? lru.bytes : 0;
+			mtx_unlock(&lru.mtx);
+		}
+		lru_sync(0);
+		sleep_ms(LRU_CHECK);
+	}
+	return 0;
+}
+
+// after save_start, the quota applies while the process runs
+void quota_start() {
+	if(map.quota <= 0) return;
+	StartThread(worker_evict, 0);
+}
+
+// Readahead
+// A tile read from disk is mostly followed by its neighbours a few ms
+// later, the view is a screen of tiles and pans a row or column at a
+// time. The loader that read one hands the ring of 8 around it to a
+// thread that asks the kernel to start reading them, so their loads find
+// them in the page cache instead of each waiting for the disk. Files are
+// opened and advised one by one, pack records close to each other as one
+// range. Only tiles the coverage has and that were not hinted lately are.
+// Rings more than AHEAD_QUEUE deep are dropped, they would come late.
+// -no-readahead turns it off.
+#define AHEAD_QUEUE 64
+#define AHEAD_SEEN 1024 // tiles hinted lately
+
+typedef struct AheadJob {
+	int z, x, y;
+} AheadJob;
+
+int readahead_on = 1;
+Queue* tiles_ahead;
+unsigned long long ahead_seen[AHEAD_SEEN]; // readahead thread only
+
+// a loader read the tile from disk
+void readahead_ring(const Tile* t) {
+	AheadJob* j;
+	int full;
+	if(!tiles_ahead) return;
+	mtx_lock(&tiles_ahead->mtx);
+	full = tiles_ahead->count >= AHEAD_QUEUE;
+	mtx_unlock(&tiles_ahead->mtx);
+	if(full) return;
+	j = (AheadJob*)malloc(sizeof(AheadJob));
+	j->z = t->z;
+	j->x = t->x;
+	j->y = t->y;
+	queue_push_s(tiles_ahead, j);
+}
+
+#if _WIN32
+static DWORD WINAPI worker_ahead(void* param){
+#elif __linux || __APPLE__
+static void* worker_ahead(void* param){
+#endif
+	(void)param;
+	while(1) {
+		AheadJob* j = queue_pop_wait(tiles_ahead);
+		unsigned long long keys[8];
+		int n = 0, dx, dy, side = 1 << j->z;
+		for(dy = -1; dy <= 1; ++dy) {
+			for(dx = -1; dx <= 1; ++dx) {
+				int x = (j->x + dx + side) & (side - 1), y = j->y + dy;
+				unsigned long long key = tile_key(j->z, x, y), *seen;
+				if((!dx && !dy) || y < 0 || y >= side) continue;
+				seen = &ahead_seen[(int)(key * 0x9e3779b97f4a7c15ull >> 32) & (AHEAD_SEEN - 1)];
+				if(*seen == key || (coverage.ready && !coverage_has(j->z, x, y))) continue;
+				*seen = key;
+				keys[n++] = key;
+			}
+		}
+		if(n) store.ahead(keys, n);
+		free(j);
+	}
+	return 0;
+}
+
+// after store_init, where loaders run
+void readahead_start() {
+	if(!readahead_on || !store.ahead || tiles_ahead) return;
+	tiles_ahead = make_queue();
+	StartThread(worker_ahead, 0);
+}
+
+// Writer
+// Downloaded tiles are persisted by their own threads, so disk writes
+// never hold up a download or a decode. A writer takes what is queued,
+// up to SAVE_BATCH jobs, at once. Into the file layout on Linux a batch
+// goes through io_uring, each tile a linked chain open, write, fsync
+// with -durability tile, close and rename, one submission for the
+// batch. Without io_uring, SAVE_THREADS writers put tiles one by one.
+// The pack and MBTiles stores have one writer. The store syncs when the
+// queue runs dry, after each batch with -durability batch.
+#define SAVE_BATCH 32
+#define SAVE_THREADS 4
+
+int uring_off; // -no-uring, writer threads even where io_uring works
+
+typedef struct SaveJob {
+	int z, x, y;
+	Buf* buf;
+	int del;  // remove the tile instead
+} SaveJob;
+
+Queue* tiles_save;
+int save_queued; // jobs not on disk yet, under tiles_save->mtx
+int save_failed; // puts that failed so far, under tiles_save->mtx
+
+void save_init() {
+	tiles_save = make_queue();
+}
+
+// takes ownership of buf
+void save_tile(const Tile* t, Buf* buf) {
+	SaveJob* j = (SaveJob*)malloc(sizeof(SaveJob));
+	j->z = t->z;
+	j->x = t->x;
+	j->y = t->y;
+	j->buf = buf;
+	j->del = 0;
+	mtx_lock(&tiles_save->mtx);
+	++save_queued;
+	mtx_unlock(&tiles_save->mtx);
+	queue_push_s(tiles_save, j);
+}
+
+// for stores with one writer, after the tile's queued saves
+void save_del(int z, int x, int y) {
+	SaveJob* j = (SaveJob*)calloc(1, sizeof(SaveJob));
+	j->z = z;
+	j->x = x;
+	j->y = y;
+	j->del = 1;
+	mtx_lock(&tiles_save->mtx);
+	++save_queued;
+	mtx_unlock(&tiles_save->mtx);
+	queue_push_s(tiles_save, j);
+}
+
+// a cached tile out of the store, from any thread. Files go now, the
+// writer of a pack or MBTiles file removes it after the tile's queued saves
+void store_remove(int z, int x, int y) {
+	if(store.put == files_put) files_del(z, x, y);
+	else save_del(z, x, y);
+}
+
+// until everything saved so far is on disk
+void save_wait() {
+	SaveJob* j = (SaveJob*)calloc(1, sizeof(SaveJob)); // no buf, sync the store
+	int n;
+	mtx_lock(&tiles_save->mtx);
+	++save_queued;
+	mtx_unlock(&tiles_save->mtx);
+	queue_push_s(tiles_save, j);
+	do {
+		mtx_lock(&tiles_save->mtx);
+		n = save_queued;
+		mtx_unlock(&tiles_save->mtx);
+		if(n) sleep_ms(10);
+	} while(n);
+}
+
+#if __linux
+#include <linux/io_uring.h>
+#define URING_ENTRIES 256 // 5 per tile of a batch at most
+
+typedef struct Uring {
+	int fd; // 0 - not there
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe* sqes;
+	struct io_uring_cqe* cqes;
+} Uring;
+
+Uring uring;
+
+static struct io_uring_sqe* uring_sqe(unsigned* tail, int tile, int step, int last) {
+	unsigned i = *tail & *uring.sq_mask;
+	struct io_uring_sqe* s = &uring.sqes[i];
+	memset(s, 0, sizeof(*s));
+	uring.sq_array[i] = i;
+	s->user_data = (unsigned long long)tile << 3 | step;
+	s->flags = last ? 0 : IOSQE_IO_LINK;
+	++*tail;
+	return s;
+}
+
+// opens . into direct descriptor slot 0 and closes it. Kernels before
+// 5.15 take file_index for padding and hand back a plain descriptor
+static int uring_direct(int fd) {
+	unsigned tail = *uring.sq_tail, head;
+	struct io_uring_sqe* s;
+	int res[2] = {-1, -1};
+	s = uring_sqe(&tail, 0, 0, 0);
+	s->opcode = IORING_OP_OPENAT;
+	s->fd = AT_FDCWD;
+	s->addr = (unsigned long long)(uintptr_t)".";
+	s->open_flags = O_RDONLY | O_DIRECTORY;
+	s->file_index = 1;
+	s = uring_sqe(&tail, 0, 1, 1);
+	s->opcode = IORING_OP_CLOSE;
+	s->file_index = 1;
+	__atomic_store_n(uring.sq_tail, tail, __ATOMIC_RELEASE);
+	if(syscall(__NR_io_uring_enter, fd, 2, 2, IORING_ENTER_GETEVENTS, 0, 0) != 2) return 0;
+	for(head = *uring.cq_head; head != __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE); ++head) {
+		struct io_uring_cqe* c = &uring.cqes[head & *uring.cq_mask];
+		res[c->user_data & 1] = c->res;
+		if((c->user_data & 1) == 0 && c->res > 0) close(c->res);
+	}
+	__atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+	return res[0] == 0 && res[1] == 0;
+}
+
+// a ring with SAVE_BATCH direct file slots, 0 - the kernel can't
+int uring_init() {
+	struct io_uring_params p;
+	struct io_uring_probe* probe;
+	int files[SAVE_BATCH], ops[] = {IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_FSYNC, IORING_OP_CLOSE, IORING_OP_RENAMEAT};
+	char *sq, *cq;
+	int fd, i, ok;
+	memset(&p, 0, sizeof(p));
+	if((fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) < 0) return 0;
+	sq = (char*)mmap(0, p.sq_off.array + p.sq_entries * sizeof(unsigned), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	cq = (char*)mmap(0, p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	uring.sqes = (struct io_uring_sqe*)mmap(0, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	probe = (struct io_uring_probe*)calloc(1, sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op));
+	for(i = 0; i < SAVE_BATCH; ++i) files[i] = -1;
+	ok = sq != MAP_FAILED && cq != MAP_FAILED && uring.sqes != MAP_FAILED &&
+		syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES, files, SAVE_BATCH) == 0 &&
+		syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0;
+	for(i = 0; ok && i < (int)(sizeof(ops) / sizeof(ops[0])); ++i) {
+		ok = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+	}
+	free(probe);
+	if(ok) {
+		uring.sq_tail = (unsigned*)(sq + p.sq_off.tail);
+		uring.sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+		uring.sq_array = (unsigned*)(sq + p.sq_off.array);
+		uring.cq_head = (unsigned*)(cq + p.cq_off.head);
+		uring.cq_tail = (unsigned*)(cq + p.cq_off.tail);
+		uring.cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+		uring.cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+		ok = uring_direct(fd);
+	}
+	if(!ok) {
+		close(fd);
+		return 0;
+	}
+	uring.fd = fd;
+	return 1;
+}
+
+typedef struct UringTile {
+	char filename[64];
+	char tmp[FILES_TMP];
+	int res;  // first error, 0 - on disk
+	int end;  // entries of the batch up to and with this tile's chain
+} UringTile;
+
+// files store, ok[i] for the jobs with a buf
+void uring_put(SaveJob** jobs, int n, int* ok) {
+	UringTile t[SAVE_BATCH];
+	unsigned tail = *uring.sq_tail, head;
+	int i, sent = 0, submitted = 0, done = 0, fd = uring.fd;
+	for(i = 0; i < n; ++i) {
+		SaveJob* j = jobs[i];
+		struct io_uring_sqe* s;
+		t[i].res = 0;
+		if(!j->buf) continue;
+		tile_filename(j->z, j->x, j->y, t[i].filename);
+		files_tmp(t[i].filename, t[i].tmp);
+		if(!files_dir(t[i].filename)) {
+			t[i].res = -ENOENT;
+			continue;
+		}
+		s = uring_sqe(&tail, i, 0, 0);
+		s->opcode = IORING_OP_OPENAT;
+		s->fd = AT_FDCWD;
+		s->addr = (unsigned long long)(uintptr_t)t[i].tmp;
+		s->len = 0644;
+		s->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+		s->file_index = i + 1; // a direct descriptor in slot i
+		s = uring_sqe(&tail, i, 1, 0);
+		s->opcode = IORING_OP_WRITE;
+		s->flags |= IOSQE_FIXED_FILE;
+		s->fd = i;
+		s->addr = (unsigned long long)(uintptr_t)j->buf->data;
+		s->len = (unsigned int)j->buf->size;
+		if(save_durability == DURABLE_TILE) {
+			s = uring_sqe(&tail, i, 2, 0);
+			s->opcode = IORING_OP_FSYNC;
+			s->flags |= IOSQE_FIXED_FILE;
+			s->fd = i;
+		}
+		s = uring_sqe(&tail, i, 3, 0);
+		s->opcode = IORING_OP_CLOSE;
+		s->file_index = i + 1;
+		s = uring_sqe(&tail, i, 4, 1);
+		s->opcode = IORING_OP_RENAMEAT;
+		s->fd = AT_FDCWD;
+		s->addr = (unsigned long long)(uintptr_t)t[i].tmp;
+		s->len = AT_FDCWD;
+		s->addr2 = (unsigned long long)(uintptr_t)t[i].filename;
+		sent += save_durability == DURABLE_TILE ? 5 : 4;
+		t[i].end = sent;
+	}
+	__atomic_store_n(uring.sq_tail, tail, __ATOMIC_RELEASE);
+	// the kernel may take fewer entries than asked, the rest are offered again
+	while(submitted < sent) {
+		int r = (int)syscall(__NR_io_uring_enter, fd, sent - submitted, 0, 0, 0, 0);
+		if(r < 0 && errno == EINTR) continue;
+		if(r < 0 && errno != EAGAIN && errno != EBUSY) {
+			print("io_uring: %s, writing with threads\n", strerror(errno));
+			uring.fd = 0;
+		}
+		if(r <= 0) break;
+		submitted += r;
+	}
+	if(submitted < sent) {
+		// entries the kernel did not take are dropped from the ring, their
+		// tiles and the one it took part of are written below
+		__atomic_store_n(uring.sq_tail, tail - (sent - submitted), __ATOMIC_RELEASE);
+		for(i = 0; i < n; ++i) {
+			if(jobs[i]->buf && !t[i].res && t[i].end > submitted) t[i].res = -EAGAIN;
+		}
+	}
+	head = *uring.cq_head;
+	while(done < submitted) { // every entry taken completes, the ones of a broken chain as canceled
+		struct io_uring_cqe* c;
+		int k, step;
+		if(head == __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE)) {
+			syscall(__NR_io_uring_enter, fd, 0, submitted - done, IORING_ENTER_GETEVENTS, 0, 0);
+			continue;
+		}
+		c = &uring.cqes[head & *uring.cq_mask];
+		k = (int)(c->user_data >> 3);
+		step = (int)(c->user_data & 7);
+		if(!t[k].res && (c->res < 0 || (step == 1 && c->res != (int)jobs[k]->buf->size))) t[k].res = c->res < 0 ? c->res : -EIO;
+		__atomic_store_n(uring.cq_head, ++head, __ATOMIC_RELEASE);
+		++done;
+	}
+	for(i = 0; i < n; ++i) {
+		if(!jobs[i]->buf) continue;
+		ok[i] = !t[i].res;
+		if(ok[i]) {
+			files_unsynced = 1;
+			continue;
+		}
+		remove(t[i].tmp);
+		files_dir_forget();
+		ok[i] = files_put(jobs[i]->z, jobs[i]->x, jobs[i]->y, jobs[i]->buf);
+	}
+}
+#endif
+
+// a writer, more of them without io_uring
+#if _WIN32
+static DWORD WINAPI worker_save(void* param){
+#elif __linux || __APPLE__
+static void* worker_save(void* param){
+#endif
+	SaveJob* jobs[SAVE_BATCH];
+	int ok[SAVE_BATCH];
+	(void)param;
+	while(1) {
+		int i, n = 1, sync = 0, idle, failed = 0;
+		jobs[0] = queue_pop_wait(tiles_save);
+		while(n < SAVE_BATCH && jobs[n - 1]->buf && (jobs[n] = queue_pop_s(tiles_save)) != 0) ++n;
+#if __linux
+		if(uring.fd && store.put == files_put) uring_put(jobs, n, ok);
+		else
+#endif
+		for(i = 0; i < n; ++i) {
+			if(!jobs[i]->buf) continue;
+			ok[i] = store.put(jobs[i]->z, jobs[i]->x, jobs[i]->y, jobs[i]->buf);
+			if(save_durability == DURABLE_TILE && store.sync && store.put != files_put) store.sync(1);
+		}
+		for(i = 0; i < n; ++i) {
+			SaveJob* j = jobs[i];
+			if(j->del) store.del(j->z, j->x, j->y);
+			else if(!j->buf) sync = 1;
+			else {
+				if(!ok[i]) {
+					print("save failed %d/%d/%d\n", j->z, j->x, j->y);
+					++failed;
+				}
+				else {
+					coverage_add(j->z, j->x, j->y);
+					lru_put(j->z, j->x, j->y, j->buf->size);
+				}
+				buf_put(j->buf);
+			}
+			free(j);
+		}
+		if(sync || save_durability == DURABLE_BATCH) {
+			if(store.sync) store.sync(1);
+			if(sync) {
+				coverage_sync(1);
+				lru_sync(1);
+			}
+		}
+		mtx_lock(&tiles_save->mtx);
+		idle = tiles_save->count == 0;
+		mtx_unlock(&tiles_save->mtx);
+		if(idle && store.sync) store.sync(0);
+		if(idle) {
+			coverage_sync(0);
+			lru_sync(0);
+		}
+		mtx_lock(&tiles_save->mtx);
+		save_queued -= n;
+		save_failed += failed;
+		mtx_unlock(&tiles_save->mtx);
+	}
+	return 0;
+}
+
+// after store_init
+void save_start() {
+	int i, n = store.put == files_put ? SAVE_THREADS : 1;
+#if __linux
+	if(store.put == files_put && !uring_off && (uring.fd || uring_init())) n = 1;
+#endif
+	for(i = 0; i < n; ++i) StartThread(worker_save, 0);
+	if(!lru.e) lru_init(map.name);
+	coverage_start();
+	quota_start();
+}
+
+// Meta
+// Per tile fetch metadata: fetch time and the validators the server sent.
+// Kept in a hash table in memory and appended to <provider>/tiles.meta,
+// the last record of a tile wins. The log is compacted on load.
+#define META_PENDING 1 // revalidation queued
+#define META_NODATA  2 // provider has no imagery here, draw an ancestor
+#define META_MEMORY  META_PENDING // flags not written to the log
+
+typedef struct TileMeta {
+	unsigned long long key;
+	unsigned int fetched;   // unix time
+	unsigned int flags;
+	char etag[64];
+	char modified[32];      // Last-Modified as the server sent it
+} TileMeta;
+
+typedef struct MetaTable {
+	TileMeta* slots;
+	int cap;
+	int count;
+	FILE* log;
+	int unflushed;
+	double flushed;
+	mtx_t mtx;
+} MetaTable;
+
+MetaTable meta;
+
+static TileMeta* meta_slot(unsigned long long key) {
+	unsigned int i = (unsigned int)(key ^ (key >> 29)) * 2654435761u & (meta.cap - 1);
+	while(meta.slots[i].key && meta.slots[i].key != key) i = (i + 1) & (meta.cap - 1);
+	return &meta.slots[i];
+}
+
+static void meta_grow() {
+	TileMeta* old = meta.slots;
+	int i, cap = meta.cap;
+	meta.cap = cap ? cap * 2 : 4096;
+	meta.slots = (TileMeta*)calloc(meta.cap, sizeof(TileMeta));
+	for(i = 0; i < cap; ++i) {
+		if(old[i].key) *meta_slot(old[i].key) = old[i];
+	}
+	free(old);
+}
+
+// memory only flags of an existing record are kept
+static void meta_insert(const TileMeta* m) {
+	TileMeta* s;
+	unsigned int flags;
+	if((meta.count + 1) * 10 > meta.cap * 7) meta_grow();
+	s = meta_slot(m->key);
+	if(!s->key) ++meta.count;
+	flags = s->key ? s->flags & META_MEMORY : 0;
+	*s = *m;
+	s->flags = (m->flags & ~META_MEMORY) | flags;
+}
+
+static void meta_write(FILE* f, const TileMeta* m) {
+	fprintf(f, "%llx %u %x %s %s\n", m->key, m->fetched, m->flags & ~META_MEMORY,
+		m->etag[0] ? m->etag : "-", m->modified[0] ? m->modified : "-");
+}
+
+static int meta_read(FILE* f, TileMeta* m) {
+	char line[256];
+	while(fgets(line, sizeof(line), f)) {
+		char* modified = line;
+		int i;
+		memset(m, 0, sizeof(TileMeta));
+		if(sscanf(line, "%llx %u %x %63s", &m->key, &m->fetched, &m->flags, m->etag) != 4) continue;
+		// Last-Modified has spaces, it is the rest of the line
+		for(i = 0; i < 4 && modified; ++i) {
+			modified = strchr(modified, ' ');
+			if(modified) ++modified;
+		}
+		if(modified) {
+			size_t n = strcspn(modified, "\r\n");
+			if(n >= sizeof(m->modified)) n = sizeof(m->modified) - 1;
+			memcpy(m->modified, modified, n);
+		}
+		if(strcmp(m->etag, "-") == 0) m->etag[0] = 0;
+		if(strcmp(m->modified, "-") == 0) m->modified[0] = 0;
+		return 1;
+	}
+	return 0;
+}
+
+void meta_init(const char* dir) {
+	char path[64], tmp[68];
+	FILE* f;
+	TileMeta m;
+	int records = 0;
+	mtx_init(&meta.mtx);
+	meta_grow();
+	sprintf(path, "%s/tiles.meta", dir);
+	mkpath(path);
+	if((f = fopen(path, "r")) != 0) {
+		while(meta_read(f, &m)) {
+			meta_insert(&m);
+			++records;
+		}
+		fclose(f);
+	}
+	if(records > 2 * meta.count + 1024) { // compact
+		int i;
+		sprintf(tmp, "%s.tmp", path);
+		if((f = fopen(tmp, "w")) != 0) {
+			for(i = 0; i < meta.cap; ++i) {
+				if(meta.slots[i].key) meta_write(f, &meta.slots[i]);
+			}
+			if(fclose(f) == 0) rename(tmp, path);
+		}
+	}
+	meta.log = fopen(path, "a");
+	// big enough that every flush is one write of whole records, seeders
+	// sharing the cache append to the same log
+	if(meta.log) setvbuf(meta.log, 0, _IOFBF, 32 * 1024);
+	meta.flushed = time_ms();
+}
+
+int meta_get(unsigned long long key, TileMeta* m) {
+	TileMeta* s;
+	mtx_lock(&meta.mtx);
+	s = meta_slot(key);
+	if(s->key) *m = *s;
+	mtx_unlock(&meta.mtx);
+	return s->key != 0;
+}
+
+void meta_put(const TileMeta* m) {
+	mtx_lock(&meta.mtx);
+	meta_insert(m);
+	if(meta.log) {
+		meta_write(meta.log, m);
+		if(++meta.unflushed >= 64 || time_ms() - meta.flushed > 1000) {
+			fflush(meta.log);
+			meta.unflushed = 0;
+			meta.flushed = time_ms();
+		}
+	}
+	mtx_unlock(&meta.mtx);
+}
+
+// set or clear memory only flags, returns the old flags
+unsigned int meta_flag(unsigned long long key, unsigned int flag, int on) {
+	TileMeta* s;
+	unsigned int old = 0;
+	mtx_lock(&meta.mtx);
+	if((meta.count + 1) * 10 > meta.cap * 7) meta_grow();
+	s = meta_slot(key);
+	if(!s->key) {
+		memset(s, 0, sizeof(TileMeta));
+		s->key = key;
+		++meta.count;
+	}
+	old = s->flags;
+	if(on) s->flags |= flag;
+	else s->flags &= ~flag;
+	mtx_unlock(&meta.mtx);
+	return old;
+}
+
+// Net
+// One thread drives every download through curl multi, with up to
+// NET_MAX_TRANSFERS transfers in flight and HTTP/2 multiplexing where
+// the server has it. Loaders queue tiles missing on disk with net_fetch.
+// Bodies are kept in memory: finished tiles go back to the front of
+// tiles_load with t->body set and are decoded from it.
+// Transfers start within the provider limits: at most host_conns per
+// subdomain and no faster than its token bucket allows.
+// Expired tiles are shown from disk and revalidated with a conditional
+// request at low priority, a 304 only refreshes their metadata.
+// Nothing is committed before the status and content type are checked.
+// Transient failures are retried with jittered exponential backoff, and
+// while the provider breaker is open waiting tiles are failed at once so
+// the view falls back to cached ancestors.
+// Every transfer has connect, total and low speed deadlines from the
+// provider. A transfer that hits one is aborted and retried at low
+// priority.
+// Mirror sources come first: a fetch starts on the first http mirror
+// whose breaker is closed and moves on to the next source on a miss or
+// an error without retrying, so only real misses reach the provider.
+// How many provider transfers run at once adapts: the AIMD window grows
+// while answers come back at flat latency and is halved on 429/503,
+// stalls or latency spikes. host_conns stays the per host cap.
+// Prefetches download tiles nobody shows yet straight to disk, behind
+// everything else, and are dropped when the tile is there already.
+// With hedging on, a demand transfer slower than the provider p90 gets
+// a duplicate on another subdomain. The first good answer wins and the
+// other transfer is cancelled. Duplicates are capped at hedge_pct of
+// all requests.
+#define NET_MAX_TRANSFERS 256
+#define NET_RETRIES 4
+#define NET_BACKOFF 250     // ms, doubles every attempt
+#define TILE_RETRY_MS 15000 // a failed tile may be requested again after
+
+enum { FETCH_OK, FETCH_NOT_MODIFIED, FETCH_RETRY, FETCH_FAIL, FETCH_NODATA };
+
+enum { NET_DEMAND, NET_LOW, NET_PREFETCH, NET_PRIO_COUNT };
+
+#define FETCH_REVALIDATE 1
+#define FETCH_PREFETCH   2 // own tile, only goes to disk
+#define FETCH_SEED       4 // with FETCH_PREFETCH, counted by the seeder
+#define NET_PREFETCH_MAX 64 // queued prefetches, older ones are stale
+
+typedef struct Fetch {
+	Tile* tile;     // holds one ref
+	CURL* curl;
+	Buf* body;
+	struct curl_slist* headers;
+	int shard;      // subdomain
+	int source;     // index in map.sources, sources_count - the provider
+	int prio;
+	int flags;
+	int attempts;
+	double not_before; // retry backoff, ms
+	int retry_after;   // seconds, from the server
+	double started;    // ms
+	int slot;          // in net_active
+	struct Fetch* twin; // hedged duplicate of the same tile
+	int is_hedge;      // the duplicate, does not own the tile ref
+	int full;          // the provider window was the limit when it started
+	int nodata;        // the provider marked the answer as a placeholder
+	char filename[64];
+	char etag[64];
+	char modified[32];
+	char ctype[32];
+} Fetch;
+
+CURLM* multi;
+Queue* net_pending; // Fetch* from loaders
+Queue* net_waiting[NET_PRIO_COUNT]; // Fetch* waiting for a transfer, net thread only
+Queue* net_retry;   // Fetch* backing off, net thread only
+Array* net_handles; // idle easy handles, net thread only
+Fetch* net_active[NET_MAX_TRANSFERS]; // transfers in flight, net thread only
+int net_inflight = 0;
+
+typedef struct NetStats {
+	int requests;
+	int ok;
+	int not_modified;
+	int failed;
+	int retries;
+	int stalls;    // deadline hit
+	int hedges;
+	int hedge_wins;
+	int nodata;    // placeholders
+	double bytes;
+} NetStats;
+
+NetStats net_stats;
+
+// mirror the fetch is on, 0 - the provider
+Source* fetch_source(Fetch* f) {
+	return f->source < map.sources_count ? &map.sources[f->source] : 0;
+}
+
+void net_stats_print() {
+	int i;
+	for(i = 0; i < map.sources_count; ++i) {
+		Source* s = &map.sources[i];
+		print("mirror %s: %d hits, %d misses, %d in flight%s\n", s->base, s->hits, s->misses,
+			s->inflight, breaker_open(&s->breaker) ? ", down" : "");
+		if(s->arc) print("archive %s: %d reads, %d tiles came with a neighbour's read\n", s->base, s->arc->reads, s->arc->batched);
+	}
+	print("net: %d requests, %d ok, %d not modified, %d no data, %d failed, %d retries, %d stalls, %d hedges (%d won), %.1f MB, %d in flight, window %d, p90 %.0f ms\n",
+		net_stats.requests, net_stats.ok, net_stats.not_modified, net_stats.nodata, net_stats.failed,
+		net_stats.retries, net_stats.stalls, net_stats.hedges, net_stats.hedge_wins,
+		net_stats.bytes / (1024 * 1024), net_inflight, (int)map.window.size, map.latency.p90);
+}
+
+void net_init() {
+	int i;
+	multi = curl_multi_init();
+	curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+	curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, 64L);
+	net_pending = make_queue();
+	for(i = 0; i < NET_PRIO_COUNT; ++i) net_waiting[i] = make_queue();
+	net_retry = make_queue();
+	net_handles = make_array(64);
+	window_init(&map.window, map.host_conns, 1, map.host_conns * SUBDOMAINS);
+}
+
+void net_fetch(Tile* t, int prio, int flags) {
+	Fetch* f = (Fetch*)calloc(1, sizeof(Fetch));
+	f->tile = t;
+	f->prio = prio;
+	f->flags = flags;
+	// a mirror's copy may be as old as ours, only the provider can say
+	if(flags & FETCH_REVALIDATE) f->source = map.sources_count;
+	f->shard = mapprovider_subdomain(&map, t);
+	mapprovider_getFileName(&map, t, f->filename);
+	queue_push_s(net_pending, f);
+	curl_multi_wakeup(multi);
+}
+
+void seed_result(int result);
+
+// give the tile back to loaders for decode. If nobody wants it anymore
+// the body still goes to disk. Failed tiles keep showing their ancestor
+// and are requested again after a while, placeholders never.
+void net_done(Fetch* f, int result) {
+	Tile* t = f->tile;
+	int ok = result == FETCH_OK;
+	if(f->flags & FETCH_PREFETCH) {
+		if(f->flags & FETCH_SEED) seed_result(result);
+		if(ok) save_tile(f->tile, f->body);
+		else if(f->body) buf_put(f->body);
+		if(f->headers) curl_slist_free_all(f->headers);
+		free(f->tile);
+		free(f);
+		return;
+	}
+	if(f->flags & FETCH_REVALIDATE) meta_flag(tile_key(t->z, t->x, t->y), META_PENDING, 0);
+	mtx_lock(&tiles_load->mtx);
+	if(!ok || t->ref == 1) {
+		if(result == FETCH_FAIL && !(f->flags & FETCH_REVALIDATE)) {
+			t->retry_at = maxd(time_ms() + TILE_RETRY_MS, map.breaker.open_until);
+		}
+		if(result == FETCH_NODATA) t->retry_at = HUGE_VAL;
+		tile_release(t);
+		mtx_unlock(&tiles_load->mtx);
+		if(ok) save_tile(t, f->body);
+		else if(f->body) buf_put(f->body);
+	} else {
+		t->body = f->body;
+		mtx_unlock(&tiles_load->mtx);
+		deque_push_front_s(tiles_load, t);
+	}
+	if(f->headers) curl_slist_free_all(f->headers);
+	free(f);
+}
+
+// value of header "name" into out, case insensitive
+int header_value(const char* buf, size_t n, const char* name, char* out, size_t size) {
+	size_t i, len = strlen(name);
+	if(n <= len || buf[len] != ':') return 0;
+	for(i = 0; i < len; ++i) {
+		if(tolower((unsigned char)buf[i]) != tolower((unsigned char)name[i])) return 0;
+	}
+	buf += len + 1;
+	n -= len + 1;
+	while(n && *buf == ' ') { ++buf; --n; }
+	while(n && (buf[n - 1] == '\r' || buf[n - 1] == '\n' || buf[n - 1] == ' ')) --n;
+	if(n >= size) n = size - 1;
+	memcpy(out, buf, n);
+	out[n] = 0;
+	return 1;
+}
+
+size_t net_header(char* buf, size_t size, size_t nitems, void* userp) {
+	Fetch* f = (Fetch*)userp;
+	size_t n = size * nitems;
+	char value[16];
+	if(header_value(buf, n, "ETag", f->etag, sizeof(f->etag))) return n;
+	if(header_value(buf, n, "Last-Modified", f->modified, sizeof(f->modified))) return n;
+	if(header_value(buf, n, "Content-Type", f->ctype, sizeof(f->ctype))) return n;
+	if(header_value(buf, n, "Retry-After", value, sizeof(value))) f->retry_after = atoi(value);
+	else if(map.nodata_header[0] && header_value(buf, n, map.nodata_header, value, sizeof(value))) {
+		f->nodata = strcmp(value, map.nodata_value) == 0;
+	}
+	return n;
+}
+
+void net_start(Fetch* f) {
+	char url[256];
+	Source* src;
+	CURL* curl = array_pop(net_handles);
+	if(!curl) curl = curl_make_handle();
+
+	if(f->headers) {
+		curl_slist_free_all(f->headers);
+		f->headers = 0;
+	}
+	if(f->flags & FETCH_REVALIDATE) {
+		char header[128];
+		Tile* t = f->tile;
+		TileMeta m;
+		if(meta_get(tile_key(t->z, t->x, t->y), &m)) {
+			if(m.etag[0]) {
+				sprintf(header, "If-None-Match: %s", m.etag);
+				f->headers = curl_slist_append(f->headers, header);
+			}
+			if(m.modified[0]) {
+				sprintf(header, "If-Modified-Since: %s", m.modified);
+				f->headers = curl_slist_append(f->headers, header);
+			}
+		}
+	}
+	f->etag[0] = 0;
+	f->modified[0] = 0;
+	f->ctype[0] = 0;
+	f->retry_after = 0;
+	f->nodata = 0;
+	f->body = buf_get();
+	if((src = fetch_source(f)) != 0) {
+		snprintf(url, sizeof(url), "%s/%s", src->base, f->filename);
+		++src->inflight;
+	} else {
+		mapprovider_getUrlName(&map, f->tile, f->shard, url);
+		++map.host_inflight[f->shard];
+		f->full = mapprovider_inflight(&map) >= (int)map.window.size;
+	}
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	// only TLS can turn out to be HTTP/2, waiting on a plain HTTP/1.1
+	// connection that closes after each answer serializes every transfer
+	curl_easy_setopt(curl, CURLOPT_PIPEWAIT, strncmp(url, "https:", 6) == 0 ? 1L : 0L);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, f->headers);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, net_header);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, f);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, buf_write);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, f->body);
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, (long)(src ? src->connect_timeout : map.connect_timeout));
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)map.timeout);
+	curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, (long)map.low_speed);
+	curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long)map.low_speed_time);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, f);
+	f->curl = curl;
+	f->started = time_ms();
+	curl_multi_add_handle(multi, curl);
+	f->slot = net_inflight;
+	net_active[net_inflight++] = f;
+	bucket_take(src ? &src->bucket : &map.bucket);
+	++net_stats.requests;
+}
+
+// what to do with a finished transfer
+int fetch_result(CURLcode res, long code, Fetch* f) {
+	if(res != CURLE_OK) {
+		if(res == CURLE_URL_MALFORMAT || res == CURLE_UNSUPPORTED_PROTOCOL) return FETCH_FAIL;
+		return FETCH_RETRY;
+	}
+	if(code == 304) return FETCH_NOT_MODIFIED;
+	if(code == 200) {
+		if(f->body->size == 0) return FETCH_RETRY;
+		if(f->ctype[0] && strncmp(f->ctype, "image/", 6) != 0) return FETCH_FAIL;
+		return FETCH_OK;
+	}
+	if(code == 408 || code == 429 || code >= 500) return FETCH_RETRY;
+	return FETCH_FAIL;
+}
+
+void net_remove(Fetch* f) {
+	Fetch* last = net_active[--net_inflight];
+	net_active[f->slot] = last;
+	last->slot = f->slot;
+	curl_multi_remove_handle(multi, f->curl);
+	array_push(net_handles, f->curl);
+	f->curl = 0;
+	if(fetch_source(f)) --fetch_source(f)->inflight;
+	else --map.host_inflight[f->shard];
+}
+
+// drop a transfer that lost the race, it does not own the tile
+void net_discard(Fetch* f) {
+	if(f->curl) net_remove(f);
+	if(f->body) buf_put(f->body);
+	if(f->headers) curl_slist_free_all(f->headers);
+	free(f);
+}
+
+void net_finish(CURLMsg* msg) {
+	Fetch* f;
+	Tile* t;
+	long code = 0;
+	int result;
+	TileMeta m;
+	Source* src;
+	curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&f);
+	curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &code);
+	net_remove(f);
+
+	t = f->tile;
+	src = fetch_source(f);
+	result = fetch_result(msg->data.result, code, f);
+	if(result == FETCH_OK && (f->nodata || mapprovider_placeholder(&map, f->body->data, f->body->size))) {
+		result = FETCH_NODATA;
+	}
+	// 404 and friends mean the server is fine
+	breaker_result(src ? &src->breaker : &map.breaker, result != FETCH_RETRY);
+	if(f->body) net_stats.bytes += f->body->size;
+	if(src) {
+		if(result != FETCH_OK && result != FETCH_NOT_MODIFIED && result != FETCH_NODATA) { // try the next source
+			++src->misses;
+			++f->source;
+			buf_put(f->body);
+			f->body = 0;
+			queue_push(net_waiting[f->prio], f);
+			return;
+		}
+		++src->hits;
+	} else if(result == FETCH_OK || result == FETCH_NODATA) {
+		latency_add(&map.latency, time_ms() - f->started);
+		window_ok(&map.window, time_ms() - f->started, f->full);
+	} else if(code == 429 || code == 503 || msg->data.result == CURLE_OPERATION_TIMEDOUT) {
+		window_cut(&map.window);
+	}
+	if(msg->data.result == CURLE_OPERATION_TIMEDOUT) {
+		++net_stats.stalls;
+		f->prio = maxi(f->prio, NET_LOW); // behind everything that still works
+	}
+
+	if(f->twin) { // hedged: the first good answer wins
+		Fetch* twin = f->twin;
+		f->twin = 0;
+		twin->twin = 0;
+		if(result == FETCH_OK || result == FETCH_NOT_MODIFIED || result == FETCH_NODATA) {
+			if(f->is_hedge) ++net_stats.hedge_wins;
+			f->is_hedge = 0;
+			net_discard(twin);
+		} else { // the other one is still running, it owns the tile now
+			twin->is_hedge = 0;
+			net_discard(f);
+			return;
+		}
+	}
+
+	if(result == FETCH_RETRY && ++f->attempts < NET_RETRIES && !breaker_open(&map.breaker)) {
+		double backoff = NET_BACKOFF * (double)(1 << f->attempts);
+		++net_stats.retries;
+		backoff = backoff / 2 + backoff * (rand() % 1000) / 2000.0; // jitter
+		if(f->retry_after > 0) backoff = maxd(backoff, f->retry_after * 1000.0);
+		f->not_before = time_ms() + backoff;
+		buf_put(f->body);
+		f->body = 0;
+		queue_push(net_retry, f);
+		return;
+	}
+	if(result == FETCH_RETRY) result = FETCH_FAIL;
+	if(result == FETCH_FAIL) {
+		++net_stats.failed;
+		net_done(f, FETCH_FAIL);
+		return;
+	}
+
+	memset(&m, 0, sizeof(m));
+	m.key = tile_key(t->z, t->x, t->y);
+	if(result == FETCH_NOT_MODIFIED) { // still fresh, keep the validators we have
+		TileMeta old;
+		if(meta_get(m.key, &old)) m = old;
+		m.fetched = (unsigned int)time(0);
+		meta_put(&m);
+		++net_stats.not_modified;
+		net_done(f, FETCH_NOT_MODIFIED);
+		return;
+	}
+	m.fetched = (unsigned int)time(0);
+	if(!strchr(f->etag, ' ')) strcpy(m.etag, f->etag);
+	strcpy(m.modified, f->modified);
+	if(result == FETCH_NODATA) {
+		m.flags = META_NODATA;
+		meta_put(&m);
+		// the copy we had is gone at the provider, it would be hidden but kept
+		if((f->flags & FETCH_REVALIDATE) || (coverage.ready && coverage_has(t->z, t->x, t->y))) {
+			store_remove(t->z, t->x, t->y);
+			coverage_del(t->z, t->x, t->y);
+			lru_del(t->z, t->x, t->y);
+		}
+		++net_stats.nodata;
+		net_done(f, FETCH_NODATA);
+		return;
+	}
+	meta_put(&m);
+	++net_stats.ok;
+	net_done(f, FETCH_OK);
+}
+
+// nobody wants the tile anymore while the fetch waits
+int fetch_dropped(Fetch* f) {
+	return f->tile->ref == 1 && !(f->flags & (FETCH_REVALIDATE | FETCH_PREFETCH));
+}
+
+// move retries whose backoff is over back to waiting, returns ms to the next one
+int net_retry_due() {
+	Node* cur = net_retry->first, *prev = 0;
+	double now = time_ms(), next = 1000;
+	while(cur) {
+		Fetch* f = (Fetch*)cur->data;
+		Node* next_node = cur->next;
+		if(fetch_dropped(f)) { // dropped while waiting
+			queue_unlink(net_retry, prev, cur);
+			net_done(f, FETCH_FAIL);
+		} else if(f->not_before <= now) {
+			queue_unlink(net_retry, prev, cur);
+			queue_push(net_waiting[f->prio], f);
+		} else {
+			next = mind(next, f->not_before - now);
+			prev = cur;
+		}
+		cur = next_node;
+	}
+	return (int)next + 1;
+}
+
+// provider is down: fail everything waiting for it, the view uses ancestors.
+// Fetches still on a mirror stay.
+void net_drop_waiting() {
+	int i;
+	Fetch* f;
+	for(i = 0; i < NET_PRIO_COUNT; ++i) {
+		Queue* q = net_waiting[i];
+		Node* cur = q->first, *prev = 0;
+		while(cur) {
+			Node* next = cur->next;
+			f = (Fetch*)cur->data;
+			if(fetch_source(f)) {
+				prev = cur;
+			} else {
+				queue_unlink(q, prev, cur);
+				net_done(f, FETCH_FAIL);
+			}
+			cur = next;
+		}
+	}
+	while((f = queue_pop(net_retry)) != 0) net_done(f, FETCH_FAIL);
+}
+
+// may the fetch start now: skips mirrors that are down or not http,
+// then checks the limits of its source. *timeout is cut to the next token.
+int net_ready(Fetch* f, int* timeout) {
+	Source* src;
+	Bucket* b;
+	double wait;
+	while((src = fetch_source(f)) != 0) {
+		if(src->kind == SOURCE_HTTP && !breaker_open(&src->breaker) && !src->breaker.probing) break;
+		++f->source;
+	}
+	if(src) {
+		if(src->inflight >= src->conns) return 0;
+	} else if(map.host_inflight[f->shard] >= map.host_conns || mapprovider_inflight(&map) >= (int)map.window.size) {
+		return 0;
+	}
+	b = src ? &src->bucket : &map.bucket;
+	if((wait = bucket_wait(b)) > 0) {
+		*timeout = mini(*timeout, (int)wait + 1);
+		return 0;
+	}
+	if(src) {
+		if(!breaker_allow(&src->breaker)) return 0;
+	} else if(!breaker_allow(&map.breaker)) {
+		return 0;
+	}
+	return 1;
+}
+
+// first waiting fetch that may start, drops unwanted tiles
+Fetch* net_next(int* timeout) {
+	int i;
+	// nothing can start, don't walk the queues
+	if(!map.sources_count && mapprovider_inflight(&map) >= (int)map.window.size) return 0;
+	for(i = 0; i < NET_PRIO_COUNT; ++i) {
+		Queue* q = net_waiting[i];
+		Node* cur = q->first, *prev = 0;
+		while(cur) {
+			Fetch* f = (Fetch*)cur->data;
+			Node* next = cur->next;
+			if(fetch_dropped(f)) { // dropped while waiting
+				queue_unlink(q, prev, cur);
+				net_done(f, FETCH_FAIL);
+			} else if(net_ready(f, timeout)) {
+				return queue_unlink(q, prev, cur);
+			} else {
+				prev = cur;
+			}
+			cur = next;
+		}
+	}
+	return 0;
+}
+
+// another subdomain with a free slot and a different host, -1 - none
+int net_hedge_shard(Fetch* f) {
+	int i;
+	for(i = 1; i < SUBDOMAINS; ++i) {
+		int s = (f->shard + i) % SUBDOMAINS;
+		if(map.host_inflight[s] >= map.host_conns) continue;
+		if(strcmp(map.subdomians[s], map.subdomians[f->shard]) == 0) continue;
+		return s;
+	}
+	return -1;
+}
+
+// duplicate demand transfers running longer than the provider p90,
+// returns ms until the next one is due
+int net_hedge() {
+	double now = time_ms(), due = map.latency.p90, next = 1000;
+	int i;
+	if(map.hedge_pct <= 0 || due <= 0) return (int)next;
+	for(i = 0; i < net_inflight; ++i) {
+		Fetch* f = net_active[i], *h;
+		int shard;
+		if(f->twin || f->is_hedge || f->prio != NET_DEMAND || f->tile->ref == 1 || fetch_source(f)) continue;
+		if(now - f->started < due) {
+			next = mind(next, due - (now - f->started));
+			continue;
+		}
+		if(net_stats.hedges * 100 >= net_stats.requests * map.hedge_pct) break;
+		if(net_inflight >= NET_MAX_TRANSFERS || bucket_wait(&map.bucket) > 0) break;
+		if((shard = net_hedge_shard(f)) < 0) continue;
+		h = (Fetch*)calloc(1, sizeof(Fetch));
+		h->tile = f->tile;
+		h->prio = f->prio;
+		h->flags = f->flags;
+		h->shard = shard;
+		h->is_hedge = 1;
+		strcpy(h->filename, f->filename);
+		h->twin = f;
+		f->twin = h;
+		net_start(h);
+		++net_stats.hedges;
+	}
+	return (int)next + 1;
+}
+
+int tile_nodata(Tile* t);
+
+// new fetches from loaders, prefetches of tiles we have are dropped
+void net_take_pending() {
+	Fetch* f;
+	while((f = queue_pop_s(net_pending)) != 0) {
+		if((f->flags & FETCH_PREFETCH) && (store.has(f->tile->z, f->tile->x, f->tile->y) || tile_nodata(f->tile))) {
+			net_done(f, FETCH_NOT_MODIFIED);
+			continue;
+		}
+		queue_push(net_waiting[f->prio], f);
+	}
+	while(net_waiting[NET_PREFETCH]->count > NET_PREFETCH_MAX) {
+		net_done(queue_pop(net_waiting[NET_PREFETCH]), FETCH_FAIL);
+	}
+}
+
+int net_waiting_count() {
+	int i, n = 0;
+	for(i = 0; i < NET_PRIO_COUNT; ++i) n += net_waiting[i]->count;
+	return n;
+}
+
+#if _WIN32
+static DWORD WINAPI worker_net(void* param){
+#elif __linux || __APPLE__
+static void* worker_net(void* param){
+#endif
+	(void)param;
+	while(1) {
+		int running, left, timeout = 1000;
+		CURLMsg* msg;
+		Fetch* f;
+		net_take_pending();
+		if(net_retry->count) timeout = net_retry_due();
+		if(breaker_open(&map.breaker)) {
+			net_drop_waiting();
+			timeout = mini(timeout, (int)(map.breaker.open_until - time_ms()) + 1);
+		}
+		while(net_inflight < NET_MAX_TRANSFERS && net_waiting_count()) {
+			if((f = net_next(&timeout)) == 0) break;
+			net_start(f);
+		}
+		if(net_inflight) {
+			int hedge = net_hedge();
+			timeout = mini(timeout, hedge);
+		}
+		curl_multi_perform(multi, &running);
+		while((msg = curl_multi_info_read(multi, &left)) != 0) {
+			if(msg->msg == CURLMSG_DONE) net_finish(msg);
+		}
+		curl_multi_poll(multi, 0, 0, timeout, 0);
+	}
+	return 0;
+}
+
+enum { LOAD_OK, LOAD_FAIL, LOAD_PENDING, LOAD_MISSING };
+
+// queue a conditional request for an expired tile, it stays on screen meanwhile
+void tile_revalidate(Tile* t, time_t mtime) {
+	TileMeta m;
+	unsigned long long key = tile_key(t->z, t->x, t->y);
+	time_t fetched = mtime;
+	if(map.ttl <= 0 || map.offline) return;
+	if(meta_get(key, &m) && m.fetched) fetched = m.fetched;
+	if(time(0) - fetched < map.ttl) return;
+	if(meta_flag(key, META_PENDING, 1) & META_PENDING) return; // already queued
+	mtx_lock(&tiles_load->mtx);
+	t->ref += 1;
+	mtx_unlock(&tiles_load->mtx);
+	net_fetch(t, NET_LOW, FETCH_REVALIDATE);
+}
+
+// copy of a tile from the first mirror directory, MBTiles file or archive that has it
+Buf* source_read(Loader* l, Tile* tile, const char* filename) {
+	int i;
+	for(i = 0; i < map.sources_count; ++i) {
+		Source* s = &map.sources[i];
+		char path[256];
+		time_t mtime;
+		Buf* b;
+		if(s->kind == SOURCE_MBTILES) {
+			b = s->mb && s->mb->shared.get ? mb_get(s->mb, l, tile->z, tile->x, tile->y, &mtime) : 0;
+		} else if(s->kind == SOURCE_ARCHIVE) {
+			b = s->arc && s->arc->leaves ? arc_get(s->arc, l, tile->z, tile->x, tile->y) : 0;
+		} else if(s->kind == SOURCE_DIR) {
+			snprintf(path, sizeof(path), "%s/%s", s->base, filename);
+			b = file_read(path);
+		} else continue;
+		if(b == 0) {
+			++s->misses;
+			continue;
+		}
+		++s->hits;
+		return b;
+	}
+	return 0;
+}
+
+// the provider has no imagery for the tile, 1 - still known so
+int tile_nodata(Tile* t) {
+	TileMeta m;
+	if(!meta_get(tile_key(t->z, t->x, t->y), &m) || !(m.flags & META_NODATA)) return 0;
+	return map.offline || map.ttl <= 0 || time(0) - (time_t)m.fetched < map.ttl;
+}
+
+// decode a downloaded tile, read it from disk or a mirror, or queue it for download
+int getImageData(Loader* l, Tile* tile, stbi_uc** data) {
+	char filename[64];
+	time_t mtime;
+	int w,h,comp,placeholder;
+	Buf* b;
+	mapprovider_getFileName(&map,tile,filename);
+	if(tile->body) {
+		Buf* b = (Buf*)tile->body;
+		tile->body = 0;
+		if(mapprovider_placeholder(&map, b->data, b->size)) { // from a mirror
+			buf_put(b);
+			return LOAD_MISSING;
+		}
+		*data = stbi_load_from_memory((stbi_uc*)b->data, (int)b->size, &w, &h, &comp, 0);
+		if(*data) save_tile(tile, b);
+		else buf_put(b);
+		return *data ? LOAD_OK : LOAD_FAIL;
+	}
+	if(tile_nodata(tile)) return LOAD_MISSING;
+	if((coverage.ready && !coverage_has(tile->z, tile->x, tile->y)) || (b = store.get(l, tile->z, tile->x, tile->y, &mtime)) == 0) {
+		if((tile->body = source_read(l, tile, filename)) != 0) return getImageData(l, tile, data);
+		if(map.offline) return LOAD_MISSING;
+		net_fetch(tile, tile->idle ? NET_LOW : NET_DEMAND, 0);
+		return LOAD_PENDING;
+	}
+	// placeholders cached before we knew them
+	placeholder = map.nodata_count && mapprovider_placeholder(&map, b->data, b->size);
+	*data = !placeholder ? stbi_load_from_memory((stbi_uc*)b->data, (int)b->size, &w, &h, &comp, 0) : 0;
+	buf_put(b);
+	if(placeholder) {
+		TileMeta m;
+		memset(&m, 0, sizeof(m));
+		m.key = tile_key(tile->z, tile->x, tile->y);
+		m.fetched = (unsigned int)mtime;
+		m.flags = META_NODATA;
+		meta_put(&m);
+		store_remove(tile->z, tile->x, tile->y);
+		coverage_del(tile->z, tile->x, tile->y);
+		lru_del(tile->z, tile->x, tile->y);
+		return LOAD_MISSING;
+	}
+	if(!*data) { // broken cache file, fetch it again
+		print("bad tile %s\n", filename);
+		store_remove(tile->z, tile->x, tile->y);
+		coverage_del(tile->z, tile->x, tile->y);
+		lru_del(tile->z, tile->x, tile->y);
+		if(map.offline) return LOAD_MISSING;
+		net_fetch(tile, tile->idle ? NET_LOW : NET_DEMAND, 0);
+		return LOAD_PENDING;
+	}
+	lru_touch(tile->z, tile->x, tile->y);
+	readahead_ring(tile);
+	tile_revalidate(tile, mtime);
+	return *data ? LOAD_OK : LOAD_FAIL;
+}
+
+void tiles_limit() {
+	if(tiles->count > 512) {// 4*6*18=432. 512 tiles ~100mb texures
+		int n = tiles->count - 512;
+		while(n--) {
+			Tile* t = (Tile*)tiles->last->data;
+			//if(t->z != 1) { // todo: keet top
+				deque_pop_back(tiles);
+				tile_release(t);
+				//t = deque_removedata_s(tiles_load, t); // always last??
+				//if(t) tile_release(t);
+				//mtx_lock(&tiles_load->mtx);
+				if (tiles_load->count == 0) {
+					// it's happen
+					//print("not must happen tiles_limit tiles_load->count == 0 n %d count %d\n",n, tiles->count);
+					//mtx_unlock(&tiles_load->mtx);
+					continue;
+				}
+				if (tiles_load->last->data == (char*)t){
+					deque_pop_back(tiles_load);
+					tile_release(t);
+				} else {
+					t = deque_removedata_s(tiles_load, t); // always last??
+					if(t) {
+						//print("not must happen in tiles_limit\n");
+						tile_release(t);
+					}
+				}
+				//mtx_unlock(&tiles_load->mtx);
+			//}
+		}
+	}
+}
+
+Tile* tile_new(int x, int y, int z){
+//	char filename[64];
+	Tile* newtile = (Tile*)malloc(sizeof(Tile));
+	tile_init(newtile, x, y, z);
+	tile_make(newtile);
+
+	if (tile_tofirst_s(tiles_load,newtile) == 0){
+		newtile->ref += 1;
+		deque_push_front_s(tiles_load, newtile);
+	} else {
+		//print("new in load\n");
+	}
+
+	deque_push_front(tiles, newtile);
+	
+	return newtile;
+}
+
+// request a failed tile again once its retry time has come
+void tile_retry(Tile* t) {
+	if(t->retry_at == 0 || time_ms() < t->retry_at || t->tex) return;
+	t->retry_at = 0;
+	t->ref += 1;
+	deque_push_front_s(tiles_load, t);
+}
+
+int tile_mosaic(int z, int x, int y);
+
+void to_draw(int z, int x, int y) {
+	Tile tile = {z,x,y};
+	Tile* ret;
+	if(tiles_draw_count == TILES_DRAW_MAX || tile_mosaic(z, x, y)) return;
+	ret = tile_find(tiles, &tile);
+	if(ret == 0) {
+		Tile* newtile = tile_new(x,y,z);
+		tiles_draw[tiles_draw_count++] = newtile;
+	} else {
+		tile_tofirst(tiles,ret); // FIXME:!! second search
+		tile_tofirst_s(tiles_load,ret);
+		tile_retry(ret);
+		ret->idle = 0;
+		tiles_draw[tiles_draw_count++] = ret;
+	}
+}
+
+// offline, a tile that is not cached is drawn as its four children when
+// some of them are, ancestors fill in for the rest
+int tile_mosaic(int z, int x, int y) {
+	int i;
+	if(!map.offline || z >= 20 || coverage_has(z, x, y)) return 0;
+	if(tiles_draw_count + 4 > TILES_DRAW_MAX) return 0;
+	for(i = 0; i < 4; ++i) {
+		if(coverage_has(z + 1, x * 2 + (i & 1), y * 2 + (i >> 1))) break;
+	}
+	if(i == 4) return 0;
+	for(i = 0; i < 4; ++i) to_draw(z + 1, x * 2 + (i & 1), y * 2 + (i >> 1));
+	return 1;
+}
+
+// Idle
+// With nothing left to load the loaders fill the children of the view at
+// the next zoom level and a ring of tiles around it, so the next wheel step
+// or short pan starts from memory. Those go behind every demanded tile in
+// tiles_load and fetch at low priority.
+#define IDLE_MAX 192 // tiles per view, with the view and its ancestors under the 512 budget
+
+int idle_on = 1;
+int idle_done; // this view is filled
+int view_z, view_x0, view_y0, view_x1, view_y1; // tiles in the viewport, set by make_tiles
+
+// 1 - queued
+int idle_tile(int z, int x, int y) {
+	Tile tile;
+	Tile* t;
+	if(x < 0 || y < 0 || x >= 1 << z || y >= 1 << z) return 0;
+	tile_init(&tile, x, y, z);
+	if(tile_find(tiles, &tile)) return 0;
+	if(map.offline && !coverage_has(z, x, y)) return 0;
+	t = (Tile*)malloc(sizeof(Tile));
+	tile_init(t, x, y, z);
+	t->idle = 1;
+	tile_make(t);
+	t->ref += 1;
+	deque_push_back(tiles_load, t); // demand is pushed to the front
+	deque_push_front(tiles, t);
+	return 1;
+}
+
+void tiles_idle() {
+	int i, j, x, y, count, sent = 0;
+	if(!idle_on || idle_done) return;
+	mtx_lock(&tiles_load->mtx);
+	count = tiles_load->count;
+	mtx_unlock(&tiles_load->mtx);
+	if(count) return;
+	idle_done = 1;
+	// the ring, a pan
+	for(y = view_y0 - 1; y <= view_y1 + 1 && sent < IDLE_MAX; ++y) {
+		for(x = view_x0 - 1; x <= view_x1 + 1 && sent < IDLE_MAX; ++x) {
+			if(y < view_y0 || y > view_y1 || x < view_x0 || x > view_x1) sent += idle_tile(view_z, x, y);
+		}
+	}
+	// one zoom step in, tiles_draw ends at the center
+	if(view_z >= 18) return;
+	for(i = tiles_draw_count - 1; i >= 0 && sent < IDLE_MAX; --i) {
+		Tile* t = tiles_draw[i];
+		if(t->z != view_z || t->x < view_x0 || t->x > view_x1 || t->y < view_y0 || t->y > view_y1) continue;
+		for(j = 0; j < 4 && sent < IDLE_MAX; ++j) sent += idle_tile(t->z + 1, t->x * 2 + (j & 1), t->y * 2 + (j >> 1));
+	}
+}
+
+void make_tiles() {
+	int j, k;
+	int baseZoom = clamp((int)floor(center.zoom+0.5), 0, 18);
+
+	double tl[2]= {0,0};
+	double tr[2]= {(double)veiwport[0],0};
+	double bl[2]= {0,(double)veiwport[1]};
+	double br[2]= {(double)veiwport[0],(double)veiwport[1]};
+
+	int minCol, maxCol;
+	int minRow, maxRow;
+	int row_count;//, col;
+
+	crd_t ctl, ctr;
+	crd_t cbl, cbr;
+	crd_set2(&ctl,&center,tl,br);
+	crd_zoomto(&ctl,baseZoom);
+	crd_set2(&ctr,&center,tr,br);
+	crd_zoomto(&ctr,baseZoom);
+	crd_set2(&cbl,&center,bl,br);
+	crd_zoomto(&cbl,baseZoom);
+	crd_set2(&cbr,&center,br,br);
+	crd_zoomto(&cbr,baseZoom);
+
+	minCol = (int)floor(_mind(mind(ctl.column,ctr.column),mind(cbl.column,cbr.column)));
+	maxCol = (int)floor(_maxd(maxd(ctl.column,ctr.column),maxd(cbl.column,cbr.column)));
+	minRow = (int)floor(_mind(mind(ctl.row,ctr.row),mind(cbl.row,cbr.row)));
+	maxRow = (int)floor(_maxd(maxd(ctl.row,ctr.row),maxd(cbl.row,cbr.row)));
+
+	view_z = baseZoom;
+	view_x0 = minCol;
+	view_x1 = maxCol;
+	view_y0 = minRow;
+	view_y1 = maxRow;
+	idle_done = 0;
+
+	minCol -= 2;//FIXME: calc veiwport area
+	maxCol += 2;
+
+	row_count = (int)floor(pow(2.0, baseZoom))-1;
+	minCol = maxi(0,minCol);
+	minRow = maxi(0,minRow);
+	maxCol = mini(maxCol,row_count);
+	maxRow = mini(maxRow,row_count);
+
+	tiles_draw_count = 0;
+
+	{
+		//int j;
+		int nx = maxCol;
+		int ny = maxRow;
+		int sx = minCol;
+		int sy = minRow;
+		int n = (nx-sx+1)*(ny-sy+1);
+		//
+		Tile t[128],p;
+		int t_count=0;
+
+		//
+		while(n) {
+			for(j = sy; j <= ny; ++j) {
+				to_draw(baseZoom, nx, j); --n;
+			} if(!n) break;
+			nx--;
+			for(j = nx; j >= sx; --j) {
+				to_draw(baseZoom, j, ny); --n;
+			} if(!n) break;
+			ny--;
+			for(j = ny; j >= sy; --j) {
+				to_draw(baseZoom, sx, j); --n;
+			} if(!n) break;
+			sx++;
+			for(j = sx; j <= nx; ++j) {
+				to_draw(baseZoom, j, sy); --n;
+			} if(!n) break;
+			sy++;
+		}
+
+		for(k = 0; k < tiles_draw_count; ++k) {
+			Tile* c = tiles_draw[k];
+			tile_parent(c, &p);
+			while(p.z > 0) {
+				int has = 0;
+				c = tile_find(tiles, &p);
+				if(c == 0) {
+					// offline only ancestors on disk are worth a tile
+					if(map.offline && !coverage_has(p.z, p.x, p.y)) has = 1;
+					for(j = 0; j < t_count && !has; ++j) {
+						Tile* tt = &t[j];
+						if(tt->z == p.z&&tt->x == p.x&&tt->y == p.y) { has = 1; break; }
+					}
+					if(!has && t_count < 128) t[t_count++] = p;
+				} else {
+					tile_tofirst(tiles, c); // FIXME:!! second search
+					tile_tofirst_s(tiles_load, c);
+					tile_retry(c);
+				}
+				tile_parent(&p, &p);
+			}
+		}
+		qsort(t,t_count,sizeof(Tile),cmp_tile);
+
+		for(j = t_count-1; j >= 0; --j) {
+			/*Tile* newtile = */tile_new(t[j].x, t[j].y, t[j].z);
+		}
+	}
+}
+
+void do_exit(void){
+	//destroy_synclist(tiles_get);
+	//clear_list(tiles);
+	//destroy_list(tiles);
+	//destroyMap(&map);
 }
 
 static const char vert_src[]=
@@ -980,565 +4993,2470 @@ static const char vert_src[]=
 "	v_tex = a_tex;"
 "}";
 
-static const char frag_src[]=
-"uniform sampler2D u_tex;"
-"varying vec2 v_tex;"
-"void main(){"
-"	gl_FragColor = texture2D(u_tex, v_tex);"
-"}";
+static const char frag_src[]=
+"uniform sampler2D u_tex;"
+"varying vec2 v_tex;"
+"void main(){"
+"	gl_FragColor = texture2D(u_tex, v_tex);"
+"}";
+
+static const char vert_alpha_src[]=
+"attribute vec4 a_pos;"
+"attribute vec2 a_tex2;"
+"uniform mat4 u_proj;"
+"varying vec2 v_tex;"
+"varying vec2 v_tex2;"
+"void main(){"
+"	gl_Position = u_proj * vec4(a_pos.xy, 0, 1);"
+"	v_tex = a_pos.zw;"
+"	v_tex2 = a_tex2;"
+"}";
+
+static const char frag_alpha_src[]=
+"uniform float u_alpha;"
+"uniform sampler2D u_tex;"
+"uniform sampler2D u_tex2;"
+"varying vec2 v_tex;"
+"varying vec2 v_tex2;"
+"void main(){"
+"	gl_FragColor = (u_alpha) * texture2D(u_tex, v_tex) + (1.0-u_alpha) * texture2D(u_tex2, v_tex2);"
+"}";
+
+GLuint creatProg(const char* vert_src, const char* frag_src) {
+	GLuint prog, vert_id, frag_id;
+	//int len; char log[1000];
+
+	vert_id = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(vert_id, 1, &vert_src, 0);
+	glCompileShader(vert_id);
+
+	frag_id = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(frag_id, 1, &frag_src, 0);
+	glCompileShader(frag_id);
+
+	prog = glCreateProgram();
+	glAttachShader(prog, vert_id);
+	glAttachShader(prog, frag_id);
+	glLinkProgram(prog);
+	//glGetProgramInfoLog(prog,1000,&len,log); if (len) print("creatProg:\n %s",log);
+
+	glDeleteShader(vert_id);
+	glDeleteShader(frag_id);
+
+	return prog;
+}
+
+int tile_make(Tile* t){
+	float tx, ty;
+	float* vtx = t->vtx;
+	double scale = pow(2.0, center.zoom - t->z);
+	float ts = (float)(256.0 * scale);
+	crd_t coord = center;
+	crd_zoomto(&coord,t->z);
+	tx = (float)(t->x - coord.column) * ts;
+	ty = (float)(t->y - coord.row) * ts;
+
+	vtx[0] = tx;      vtx[1] = ty;
+	vtx[4] = tx;      vtx[5] = ty + ts;
+	vtx[8] = tx + ts; vtx[9] = ty;
+	vtx[12]= tx + ts; vtx[13]= ty + ts;
+
+	{
+		int found = 0;
+		float tz = .5f;
+		int xoff = 0, yoff = 0;
+		Tile r,*p;
+		float fx1,fy1,fx2,fy2;
+		int n = 2;
+
+		tile_parent(t, &r);
+		if(r.z == -1) return 0;
+		xoff = t->x & 1;
+		yoff = t->y & 1;
+		p = tile_find(tiles,&r);
+		if(p && p->tex) found = 1;
+		while(!found) {
+			xoff += (r.x & 1) * n;
+			yoff += (r.y & 1) * n;
+			tile_parent(&r, &r);
+			if(r.z == -1) return 0;
+			p = tile_find(tiles, &r);
+			if(p && p->tex) found = 1;
+			tz *= 0.5f;
+			n *= 2;
+		};
+		if (p==0) return 0;
+		t->ptex = p->tex;
+		tx = xoff * tz;
+		ty = yoff * tz;
+		fx1 = tx;
+		fx2 = tx + tz;
+		fy1 = ty;
+		fy2 = ty + tz;
+		vtx[2] = fx1; vtx[3] = fy1;
+		vtx[6] = fx1; vtx[7] = fy2;
+		vtx[10]= fx2; vtx[11]= fy1;
+		vtx[14]= fx2; vtx[15]= fy2;
+		return 1;
+	}
+	return 0;
+}
+
+void updateQuads() {
+	int i = 0;
+	for (i=0; i<tiles_draw_count; ++i) {
+		Tile* t = tiles_draw[i];
+		tile_make(t);
+	}
+}
+
+GLuint prog;
+GLuint u_proj;
+
+GLuint prog_alpha;
+GLuint u_alpha;
+GLuint u_tex;
+GLuint u_tex2;
+GLuint u_proj_alpha;
+
+void createOrthographicOffCenter(float left, float right, float bottom, float top,
+								 float zNearPlane, float zFarPlane, float* dst) {
+	int i;
+	for (i = 1; i < 13; ++i) dst[i] = 0;
+	dst[0] = 2 / (right - left);
+	dst[5] = 2 / (top - bottom);
+	dst[12] = (left + right) / (left - right);
+	dst[10] = 1 / (zNearPlane - zFarPlane);
+	dst[13] = (top + bottom) / (bottom - top);
+	dst[14] = zNearPlane / (zNearPlane - zFarPlane);
+	dst[15] = 1;
+}
+
+void reshape(int w, int h) {
+	float m[16];
+	veiwport[0] = w;
+	veiwport[1] = h;
+	glViewport(0, 0, w, h);
+	if (prog){
+		createOrthographicOffCenter(-w/2.f, w/2.f, h/2.f, -h/2.f, -1, 1, m);
+		glUseProgram(prog);
+		glUniformMatrix4fv(u_proj, 1, GL_FALSE, m);
+		glUseProgram(prog_alpha);
+		glUniformMatrix4fv(u_proj_alpha, 1, GL_FALSE, m);
+	}
+}
+
+int moffsetx=0;
+int moffsety=0;
+int lastzoom=-1;
+float sm_zoom,t_zoom;
+void mouse(int button, int state, int x, int y) {
+	if (state == GLUT_DOWN) {
+		moffsetx = x;
+		moffsety = y;
+	}
+
+	if (button == 3) {
+		t_zoom += 0.1f;
+		sm_zoom = (t_zoom - (float)center.zoom)*0.1f;
+	} else if (button == 4) {
+		t_zoom -= 0.1f;
+		sm_zoom = (t_zoom - (float)center.zoom)*0.1f;
+	}
+}
+
+// Prefetch
+// Pan velocity is tracked from the moves, the zoom goes to t_zoom. Tiles
+// the view will cover within PREFETCH_HORIZON ms are downloaded to disk
+// at the lowest priority, so they load from the cache when they show up.
+#define PREFETCH_HORIZON 1000 // ms
+#define PREFETCH_STEPS 4
+#define PREFETCH_RECENT 256
+
+int prefetch_on = 1;
+double pan_vx, pan_vy; // columns per ms at center.zoom, smoothed
+double pan_at;         // ms, last move
+unsigned long long prefetch_recent[PREFETCH_RECENT]; // asked lately
+int prefetch_pos;
+
+void net_prefetch(int z, int x, int y) {
+	Tile* t = (Tile*)malloc(sizeof(Tile));
+	tile_init(t, x, y, z);
+	net_fetch(t, NET_PREFETCH, FETCH_PREFETCH);
+}
+
+// 1 - asked for it
+int prefetch_tile(int z, int x, int y) {
+	Tile tile;
+	unsigned long long key;
+	int i;
+	if(x < 0 || y < 0 || x >= 1 << z || y >= 1 << z) return 0;
+	tile_init(&tile, x, y, z);
+	key = tile_key(z, x, y);
+	for(i = 0; i < PREFETCH_RECENT; ++i) {
+		if(prefetch_recent[i] == key) return 0;
+	}
+	if(tile_find(tiles, &tile)) return 0;
+	prefetch_recent[prefetch_pos] = key;
+	prefetch_pos = (prefetch_pos + 1) % PREFETCH_RECENT;
+	net_prefetch(z, x, y);
+	return 1;
+}
+
+// the view moved by dx, dy columns at center.zoom
+void pan_track(double dx, double dy) {
+	double now = time_ms(), dt = now - pan_at;
+	if(dt > 200) { // a new drag
+		pan_vx = 0;
+		pan_vy = 0;
+	} else if(dt > 0) {
+		pan_vx += (dx / dt - pan_vx) * 0.3;
+		pan_vy += (dy / dt - pan_vy) * 0.3;
+	}
+	pan_at = now;
+}
+
+void prefetch_update() {
+	double vx = pan_vx, vy = pan_vy, zoom, scale, hx, hy;
+	int z, s, x, y, sent = 0;
+	if(!prefetch_on || map.offline) return;
+	if(time_ms() - pan_at > 100) vx = vy = 0; // not dragging
+	zoom = fabs(center.zoom - t_zoom) > 0.001 ? t_zoom : center.zoom;
+	if(vx == 0 && vy == 0 && zoom == center.zoom) return;
+	z = clamp((int)floor(zoom + 0.5), 0, 18);
+	scale = pow(2.0, z - center.zoom);
+	hx = veiwport[0] / 512.0 * pow(2.0, z - zoom) + 1;
+	hy = veiwport[1] / 512.0 * pow(2.0, z - zoom) + 1;
+	for(s = 1; s <= PREFETCH_STEPS && sent < 16; ++s) {
+		double ms = PREFETCH_HORIZON * s / PREFETCH_STEPS;
+		double cx = (center.column + vx * ms) * scale;
+		double cy = (center.row + vy * ms) * scale;
+		for(y = (int)floor(cy - hy); y <= (int)floor(cy + hy); ++y) {
+			for(x = (int)floor(cx - hx); x <= (int)floor(cx + hx); ++x) sent += prefetch_tile(z, x, y);
+		}
+	}
+}
+
+void view_pan(int ox, int oy) {
+	pan_track(ox/256.0, oy/256.0);
+	center.column += ox/256.0;
+	center.row += oy/256.0;
+	make_tiles();
+	updateQuads();
+	prefetch_update();
+}
+
+void mousemove(int x,int y) {
+	int ox = moffsetx - x;
+	int oy = moffsety - y;
+	moffsetx = x;
+	moffsety = y;
+	view_pan(ox, oy);
+}
+
+int tile_make_tex(Tile* t){
+	GLuint textureId = t->tex;
+	//float* vtx = t->vtx;
+	if(!textureId) glGenTextures(1, &textureId); // revalidated tiles reuse theirs
+	glBindTexture(GL_TEXTURE_2D, textureId);
+	if (t->filename){
+		int w,h,comp;
+		stbi_uc* data = stbi_load(t->filename, &w, &h, &comp, 0);
+		glTexImage2D(GL_TEXTURE_2D, 0, 3, 256, 256, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+		free(data);
+		free(t->filename);
+		t->filename=0;
+	}else{
+		glTexImage2D(GL_TEXTURE_2D, 0, 3/*GL_COMPRESSED_RGB*/, 256, 256, 0, GL_RGB, GL_UNSIGNED_BYTE, t->texdata);
+		//glTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, 256, 256, 0, GL_RGB, GL_UNSIGNED_BYTE, t->texdata);
+		free(t->texdata);
+		t->texdata = 0;
+	}
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	t->tex = textureId;
+	//array_push(tiles_blend,t);
+	/*vtx[2] = 0; vtx[3] = 0;
+	vtx[6] = 0; vtx[7] = 1;
+	vtx[10]= 1; vtx[11]= 0;
+	vtx[14]= 1; vtx[15]= 1;*/
+	t->blend = 1.f;
+	return 1;
+}
+float clck(){
+	return (float)clock();// / CLOCKS_PER_SEC;
+}
+#if _WIN32
+static DWORD WINAPI worker_load(void* param){
+#elif __linux || __APPLE__
+static void* worker_load(void* param){
+#endif
+	Loader* l = (Loader*)param;
+	while(1){
+		//double start = clck();
+		//print("get %d\n",n);
+		Tile* t = queue_pop_wait(tiles_load);
+		mtx_lock(&tiles_load->mtx);
+		if (!tile_release(t)){
+			stbi_uc* data = 0;
+			t->ref += 1;
+			mtx_unlock(&tiles_load->mtx);
+			//print("load    %d %.4f\n",n,clck() - start);
+			switch(getImageData(l, t, &data)) {
+			case LOAD_PENDING: continue; // ref goes to the net thread
+			case LOAD_MISSING: // no data or offline and not cached, never asked again
+				t->retry_at = HUGE_VAL;
+				mtx_lock(&tiles_load->mtx);
+				tile_release(t);
+				mtx_unlock(&tiles_load->mtx);
+				continue;
+			case LOAD_FAIL: // no texture, keep drawing the ancestor
+				t->retry_at = time_ms() + TILE_RETRY_MS;
+				mtx_lock(&tiles_load->mtx);
+				tile_release(t);
+				mtx_unlock(&tiles_load->mtx);
+				continue;
+			}
+			//print("load ok %d %.4f\n",n,clck() - start);
+
+			mtx_lock(&tiles_load->mtx);
+			if (tile_release(t)){
+				mtx_unlock(&tiles_load->mtx);
+				print("release after load\n");
+				free(data);
+			} else {
+				int sl=0;
+				t->ref += 1;
+				t->texdata = data;
+//				t->download = 0;
+				array_push(tiles_loaded, t);
+				sl = tiles_loaded->count > 10;
+				mtx_unlock(&tiles_load->mtx);
+				while(sl){ // wait signal tiles_loaded->count > 10 without sleep??
+					Sleep(250);
+					mtx_lock(&tiles_load->mtx);
+					sl = tiles_loaded->count > 10;
+					mtx_unlock(&tiles_load->mtx);
+				}
+			}
+		} else {
+			print("thread release\n");
+			mtx_unlock(&tiles_load->mtx);
+		}
+	}
+	return 0;
+}
+int change=0;
+
+void Render(float f){
+    int i=0;//,j=0;
+	//GLuint ltex=-1;
+	
+	Tile* t = array_pop(tiles_loaded);
+	while(t) { // todo while -> for
+		//print("release loaded %p %2d %2d %2d\n", t, t->z, t->x, t->y);
+		if(!tile_release(t)) { // clear unused tiles
+			tile_make_tex(t);
+			change = 1;
+			// slow load in MESA.. TODO: second context
+			if(++i == 1) break; // load by 1 texture or 2 or 5.. directly load only 1 with good cpu
+		}
+		t = array_pop(tiles_loaded);
+	}
+
+	if(fabs(center.zoom - t_zoom)>0.001){
+		//print("f: %f zoom: %f center z: %f\n",f,t_zoom,center.zoom);
+		crd_zoomto(&center,center.zoom+sm_zoom);
+		change = 1;
+	}
+
+	if(change) {
+		make_tiles();
+		updateQuads();
+		prefetch_update();
+		change = 0;
+		//print("tiles_loaded count: %d\n",tiles_loaded->count);
+	}
+	tiles_idle();
+
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	glEnable(GL_TEXTURE_2D);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+
+	
+	glActiveTexture(GL_TEXTURE0);
+	for (i=0; i<tiles_draw_count; ++i) {
+		Tile* t = tiles_draw[i];
+		if (t->blend > 0 && t->tex) {
+			glUseProgram(prog_alpha);
+			glUniform1f(u_alpha,t->blend);
+
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D,t->ptex);
+			glActiveTexture(GL_TEXTURE1);
+			glBindTexture(GL_TEXTURE_2D,t->tex);
+
+			glVertexAttribPointer(0,4,GL_FLOAT,GL_FALSE,0,t->vtx);
+			glVertexAttribPointer(1,2,GL_FLOAT,GL_FALSE,0,texcoord);
+
+			t->blend-=0.0625f;
+			if(t->blend<=0.f) t->blend = 0.f;
+		} else {
+			glUseProgram(prog);
+			glActiveTexture(GL_TEXTURE0);
+			glVertexAttribPointer(0,2,GL_FLOAT,GL_FALSE,16,t->vtx);
+			if (t->tex){
+				glBindTexture(GL_TEXTURE_2D,t->tex);
+				glVertexAttribPointer(1,2,GL_FLOAT,GL_FALSE,0,texcoord);
+			} else {
+				glBindTexture(GL_TEXTURE_2D,t->ptex);
+				glVertexAttribPointer(1,2,GL_FLOAT,GL_FALSE,16,&t->vtx[2]);
+			}
+		}
+		
+		glDrawArrays(GL_TRIANGLE_STRIP,0,4);
+	}
+
+	tiles_limit();
+
+	glutSwapBuffers();
+
+	// release by 4 tiles
+	for(i=0; i<4 && (t = array_pop(tiles_release)) != 0; ++i){
+		//print("release        %p %2d %2d %2d\n", t, t->z, t->x, t->y);
+		if(t->filename) {
+			free(t->filename);
+			t->filename = 0;
+		}
+		if(t->texdata) {
+			free(t->texdata);
+			t->texdata = 0;
+		}
+		if(t->body) { // downloaded but never decoded, keep it anyway
+			save_tile(t, t->body);
+			t->body = 0;
+		}
+		if(t->tex) {
+			glDeleteTextures(1, &t->tex);
+			t->tex = 0;
+		}
+		free(t);
+	}
+}
+
+void Draw_empty(void){
+    Render(0);
+    glutPostRedisplay();
+}
+
+/*double p[][2]={
+	{-165.0,60.0},
+	{-165.0+5.0,60.0},
+	{-165.0+5.0,60.0-5.0},
+	{-165.0,60.0-5.0}
+};*/
+
+//55.3992609,-163.1431794
+
+const double pi180 = M_PI / 180.0;
+double getx(double lon, double zoom) {
+	return ((lon + 180) / 360) * pow(2, zoom);
+}
+double gety(double lat, double zoom) {
+	return (1 - log(tan(pi180*lat) + 1 / cos(pi180*lat)) / M_PI) / 2 * pow(2, zoom);
+}
+
+double getxp(double lon, double pzoom) {
+	return ((lon + 180.0) / 360.0) * pzoom;
+}
+double getyp(double lat, double pzoom) {
+	return (1 - log(tan(pi180*lat) + 1 / cos(pi180*lat)) / M_PI) / 2 * pzoom;
+}
+
+#if _MSC_VER < 1900
+double log2(double Value) {
+	return log(Value) * (1.4426950408889634073599246810019);
+}
+#endif
+
+//double lon = -163.1441188, lat = 55.3988969;
+//double lon = -71.06643059, lat = 42.35431920;
+#define NUM_POINTS 4
+double points[NUM_POINTS][3] = {
+	{-163.1441188, 55.3988969, 18.4},
+	{-71.06643059, 42.35431920, 18.4},
+	{139.62034836, -17.53323892, 18.4},
+	{18.41713920, -32.82673124, 18.4}
+};
+
+crd_t fromPointToLatLng(crd_t point, double zoom);
+crd_t fromLatLngToPoint(double lat, double lon, double zoom);
+void keyboard(unsigned char key,int x,int y){
+	if(key == 32) {
+//		double z,rx,ry;
+		crd_t ret;
+		print("row: %.16f column: %.16f zoom: %.16f\n",center.row,center.column,center.zoom);
+		//ret = fromLatLngToPoint(lat,lon, center.zoom);
+		ret = fromPointToLatLng(center, center.zoom);
+		print("lon: %.8f lat: %.8f\n",ret.x,ret.y);
+	} else if(key == 'i') {
+		net_stats_print();
+	}
+}
+
+/*
+public final class GoogleMapsProjection2 
+{
+private final int TILE_SIZE = 256;
+private PointF _pixelOrigin;
+private double _pixelsPerLonDegree;
+private double _pixelsPerLonRadian;
+
+public GoogleMapsProjection2()
+{
+	this._pixelOrigin = new PointF(TILE_SIZE / 2.0,TILE_SIZE / 2.0);
+	this._pixelsPerLonDegree = TILE_SIZE / 360.0;
+	this._pixelsPerLonRadian = TILE_SIZE / (2 * Math.PI);
+}
+
+double bound(double val, double valMin, double valMax)
+{
+	double res;
+	res = Math.max(val, valMin);
+	res = Math.min(res, valMax);
+	return res;
+}
+
+double degreesToRadians(double deg)
+{
+	return deg * (Math.PI / 180);
+}
+
+double radiansToDegrees(double rad)
+{
+	return rad / (Math.PI / 180);
+}
+
+PointF fromLatLngToPoint(double lat, double lng, int zoom)
+{
+	PointF point = new PointF(0, 0);
+
+	point.x = _pixelOrigin.x + lng * _pixelsPerLonDegree;
+
+	// Truncating to 0.9999 effectively limits latitude to 89.189. This is
+	// about a third of a tile past the edge of the world tile.
+	double siny = bound(Math.sin(degreesToRadians(lat)), -0.9999,0.9999);
+	point.y = _pixelOrigin.y + 0.5 * Math.log((1 + siny) / (1 - siny)) *- _pixelsPerLonRadian;
+
+	int numTiles = 1 << zoom;
+	point.x = point.x * numTiles;
+	point.y = point.y * numTiles;
+	return point;
+}
+
+PointF fromPointToLatLng(PointF point, int zoom)
+{
+	int numTiles = 1 << zoom;
+	point.x = point.x / numTiles;
+	point.y = point.y / numTiles;
+
+	double lng = (point.x - _pixelOrigin.x) / _pixelsPerLonDegree;
+	double latRadians = (point.y - _pixelOrigin.y) / - _pixelsPerLonRadian;
+	double lat = radiansToDegrees(2 * Math.atan(Math.exp(latRadians)) - Math.PI / 2);
+	return new PointF(lat, lng);
+}
+
+public static void main(String []args) 
+{
+	GoogleMapsProjection2 gmap2 = new GoogleMapsProjection2();
+
+	PointF point1 = gmap2.fromLatLngToPoint(41.850033, -87.6500523, 15);
+	System.out.println(point1.x+"   "+point1.y);
+	PointF point2 = gmap2.fromPointToLatLng(point1,15);
+	System.out.println(point2.x+"   "+point2.y);
+}
+}
+*/
+#define TILE_SIZE 256
+double _pixelOrigin[2] = {128.0,128.0};
+double _pixelsPerLonDegree = TILE_SIZE / 360.0;
+double _pixelsPerLonRadian = TILE_SIZE / (2.0 * M_PI);
+
+double bound(double val, double valMin, double valMax){
+	double res;
+	res = maxd(val, valMin);
+	res = mind(res, valMax);
+	return res;
+}
+
+double degreesToRadians(double deg){
+	return deg * pi180;
+}
+
+double radiansToDegrees(double rad){
+	return rad / pi180;
+}
+
+crd_t fromLatLngToPoint(double lat, double lon, double zoom){
+	crd_t point;// = new PointF(0, 0);
+	//double siny;
+	double numTiles;
+
+	point.x = getx(lon, zoom);// _pixelOrigin[0] + lon * _pixelsPerLonDegree;
+
+	// Truncating to 0.9999 effectively limits latitude to 89.189. This is
+	// about a third of a tile past the edge of the world tile.
+	//siny = bound(sin(degreesToRadians(lat)), -0.9999,0.9999);
+	//point.y = _pixelOrigin[1] + 0.5 * log((1.0 + siny) / (1.0 - siny)) * -_pixelsPerLonRadian;
+	point.y = gety(lat, zoom);
+
+	numTiles = pow(2,zoom);// 1 << zoom;
+	//point.x = point.x * numTiles;
+	//point.y = point.y * numTiles;
+	point.zoom = zoom;
+	return point;
+}
+
+crd_t fromPointToLatLng(crd_t point, double zoom){
+	crd_t ret;
+	double lon,latRadians,lat;
+	//int numTiles = 1 << zoom;
+	double numTiles = pow(2, zoom);
+	point.x = point.x / numTiles;
+	point.y = point.y / numTiles;
+
+	lon = (point.y - 0.5/*_pixelOrigin[0]*/) / (1/360.0)/*_pixelsPerLonDegree*/;
+	latRadians = (point.x - 0.5/*_pixelOrigin[1]*/) / -(1/(2.0 * M_PI))/*_pixelsPerLonRadian*/;
+	lat = radiansToDegrees(2 * atan(exp(latRadians)) - M_PI / 2);
+	ret.x = lon;
+	ret.y = lat;
+	ret.zoom = zoom;
+	return ret;
+}
+
+int num_cores(){
+#if _WIN32
+	SYSTEM_INFO sysinfo;
+	GetSystemInfo(&sysinfo);
+	return sysinfo.dwNumberOfProcessors;
+#elif __linux || __APPLE__
+	return sysconf(_SC_NPROCESSORS_ONLN);
+#else
+#error "platform error"
+#endif
+} 
+
+// provider tuning from the command line
+void map_options(MapProvider* map, int argc, char* argv[]) {
+	int i;
+	for(i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "-offline") == 0) map->offline = 1;
+	}
+	for(i = 1; i < argc - 1; ++i) {
+		if(strcmp(argv[i], "-conns") == 0) {
+			map->host_conns = atoi(argv[++i]);
+			if(map->host_conns < 1) map->host_conns = 1;
+		}
+		else if(strcmp(argv[i], "-connect-timeout") == 0) map->connect_timeout = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-timeout") == 0) map->timeout = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-stall") == 0) map->low_speed_time = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-hedge") == 0) map->hedge_pct = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-mirror") == 0) {
+			if(map->sources_count < MAX_SOURCES) source_init(&map->sources[map->sources_count++], argv[i + 1]);
+			++i;
+		}
+		else if(strcmp(argv[i], "-mirror-conns") == 0) {
+			int conns = atoi(argv[++i]);
+			if(map->sources_count) map->sources[map->sources_count - 1].conns = maxi(conns, 1);
+		}
+		else if(strcmp(argv[i], "-placeholder") == 0) { // a sample "no imagery" tile
+			Buf* b = file_read(argv[++i]);
+			if(b && map->nodata_count < MAX_SIGNATURES) {
+				map->nodata[map->nodata_count].size = b->size;
+				map->nodata[map->nodata_count++].hash = fnv1a(b->data, b->size);
+			} else {
+				print("can't use placeholder %s\n", argv[i]);
+			}
+			if(b) buf_put(b);
+		}
+		else if(strcmp(argv[i], "-no-prefetch") == 0) prefetch_on = 0;
+		else if(strcmp(argv[i], "-no-idle") == 0) idle_on = 0;
+		else if(strcmp(argv[i], "-no-readahead") == 0) readahead_on = 0;
+		else if(strcmp(argv[i], "-store") == 0) {
+			size_t n = strlen(argv[++i]);
+			map->store = strcmp(argv[i], "pack") == 0 ? STORE_PACK : STORE_FILES;
+			if(n > 8 && strcmp(argv[i] + n - 8, ".mbtiles") == 0 && n < sizeof(map->mbtiles)) {
+				map->store = STORE_MBTILES;
+				strcpy(map->mbtiles, argv[i]);
+			}
+		}
+		else if(strcmp(argv[i], "-no-uring") == 0) uring_off = 1;
+		else if(strcmp(argv[i], "-durability") == 0) {
+			++i;
+			save_durability = strcmp(argv[i], "tile") == 0 ? DURABLE_TILE : strcmp(argv[i], "batch") == 0 ? DURABLE_BATCH : DURABLE_NONE;
+		}
+		else if(strcmp(argv[i], "-quota") == 0) map->quota = atof(argv[++i]) * 1024 * 1024; // MB
+		else if(strcmp(argv[i], "-pin-zoom") == 0) map->pin_zoom = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-ttl") == 0) map->ttl = (int)(atof(argv[++i]) * 24 * 3600); // days
+		else if(strcmp(argv[i], "-rate") == 0) {
+			double rate = atof(argv[++i]);
+			bucket_init(&map->bucket, rate, rate * 2);
+		}
+	}
+	if(map->quota > 0 && map->store == STORE_PACK) {
+		print("-quota can't cap -store pack, tiles.pack never shrinks\n");
+		exit(1);
+	}
+}
 
-static const char vert_alpha_src[]=
-"attribute vec4 a_pos;"
-"attribute vec2 a_tex2;"
-"uniform mat4 u_proj;"
-"varying vec2 v_tex;"
-"varying vec2 v_tex2;"
-"void main(){"
-"	gl_Position = u_proj * vec4(a_pos.xy, 0, 1);"
-"	v_tex = a_pos.zw;"
-"	v_tex2 = a_tex2;"
-"}";
+//////////////////////////////////////////////////////////////////////////
+// Mock server
+// Local http tile server for benchmarks and offline runs: glutplanet serve.
+// Tiles come from a fixture directory laid out like our cache, or are
+// generated as grayscale PNGs. Latency, bandwidth per connection, error
+// rate and keep-alive are configurable. It speaks HTTP/1.1 only, -close
+// answers every request on a new connection like HTTP/1.0 clients see.
+#define MOCK_PORT 8765
+
+typedef struct MockOptions {
+	int port;
+	int latency;    // ms before the answer
+	int rate;       // KB/s per connection, 0 - unlimited
+	int errors;     // % of requests answered with 503
+	int close;      // no keep-alive
+	int nodata;     // zoom above which tiles are placeholders, 0 - none
+	char dir[128];  // fixture tiles, empty - generated
+} MockOptions;
+
+MockOptions mock;
+
+void mock_options(int argc, char* argv[], int port) {
+	int i;
+	mock.port = port;
+	for(i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "-port") == 0 && i + 1 < argc) mock.port = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-latency") == 0 && i + 1 < argc) mock.latency = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-bandwidth") == 0 && i + 1 < argc) mock.rate = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-errors") == 0 && i + 1 < argc) mock.errors = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-close") == 0) mock.close = 1;
+		else if(strcmp(argv[i], "-nodata") == 0 && i + 1 < argc) mock.nodata = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-dir") == 0 && i + 1 < argc) strncpy(mock.dir, argv[++i], sizeof(mock.dir) - 1);
+	}
+}
 
-static const char frag_alpha_src[]=
-"uniform float u_alpha;"
-"uniform sampler2D u_tex;"
-"uniform sampler2D u_tex2;"
-"varying vec2 v_tex;"
-"varying vec2 v_tex2;"
-"void main(){"
-"	gl_FragColor = (u_alpha) * texture2D(u_tex, v_tex) + (1.0-u_alpha) * texture2D(u_tex2, v_tex2);"
-"}";
+// mock tiles of a local server, subdomains only change the path
+void initMockMap(MapProvider* map, int port) {
+	mapprovider_init(map);
+	map->makeurl = 0;
+	map->host_conns = 16;
+	bucket_init(&map->bucket, 100000, 100000);
+
+	sprintf(map->nodata_header,"X-VE-Tile-Info"); // placeholders like bing
+	sprintf(map->nodata_value,"no-tile");
+
+	sprintf(map->name,"mock");
+	sprintf(map->subdomians[0],"a/");
+	sprintf(map->subdomians[1],"b/");
+	sprintf(map->subdomians[2],"c/");
+	sprintf(map->subdomians[3],"d/");
+	sprintf(map->urlformat,"http://127.0.0.1:%d/%%s%%d/%%d/%%d.%%s", port);
+	sprintf(map->imgformat,"png");
+}
 
-GLuint creatProg(const char* vert_src, const char* frag_src) {
-	GLuint prog, vert_id, frag_id;
-	//int len; char log[1000];
+unsigned int crc32_update(unsigned int crc, const unsigned char* p, size_t n) {
+	static unsigned int table[256];
+	size_t i;
+	if(!table[1]) {
+		unsigned int c, k, j;
+		for(j = 0; j < 256; ++j) {
+			for(c = j, k = 0; k < 8; ++k) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			table[j] = c;
+		}
+	}
+	crc = ~crc;
+	for(i = 0; i < n; ++i) crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
 
-	vert_id = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vert_id, 1, &vert_src, 0);
-	glCompileShader(vert_id);
+static void put_be32(Buf* b, unsigned int v) {
+	unsigned char d[4];
+	d[0] = v >> 24; d[1] = v >> 16; d[2] = v >> 8; d[3] = v;
+	buf_write(d, 1, 4, b);
+}
 
-	frag_id = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(frag_id, 1, &frag_src, 0);
-	glCompileShader(frag_id);
+static void png_chunk(Buf* b, const char* type, const unsigned char* data, size_t n) {
+	put_be32(b, (unsigned int)n);
+	buf_write((void*)type, 1, 4, b);
+	buf_write((void*)data, 1, n, b);
+	put_be32(b, crc32_update(crc32_update(0, (const unsigned char*)type, 4), data, n));
+}
 
-	prog = glCreateProgram();
-	glAttachShader(prog, vert_id);
-	glAttachShader(prog, frag_id);
-	glLinkProgram(prog);
-	//glGetProgramInfoLog(prog,1000,&len,log); if (len) print("creatProg:\n %s",log);
+// 256x256 grayscale checkerboard, different per tile, deflate stored blocks
+void mock_png(Buf* b, int z, int x, int y) {
+	static const unsigned char sig[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+	unsigned char ihdr[13] = {0, 0, 1, 0, 0, 0, 1, 0, 8, 0, 0, 0, 0};
+	unsigned char* raw = malloc(257 * 256);
+	unsigned char* zdata = malloc(257 * 256 + 64);
+	unsigned int a = 1, s = 0;
+	size_t i, n = 257 * 256, pos = 0, zn = 0;
+	int r, c;
+	for(r = 0; r < 256; ++r) {
+		raw[r * 257] = 0;
+		for(c = 0; c < 256; ++c) raw[r * 257 + 1 + c] = ((r >> 5) + (c >> 5)) & 1 ? 40 + z * 8 : 160 + (x + y) % 64;
+	}
+	zdata[zn++] = 0x78;
+	zdata[zn++] = 0x01;
+	while(pos < n) {
+		size_t len = mini(n - pos, 65535);
+		zdata[zn++] = pos + len == n;
+		zdata[zn++] = len & 0xff;
+		zdata[zn++] = len >> 8;
+		zdata[zn++] = ~len & 0xff;
+		zdata[zn++] = (~len >> 8) & 0xff;
+		memcpy(zdata + zn, raw + pos, len);
+		zn += len;
+		pos += len;
+	}
+	for(i = 0; i < n; ++i) {
+		a = (a + raw[i]) % 65521;
+		s = (s + a) % 65521;
+	}
+	zdata[zn++] = s >> 8; zdata[zn++] = s & 0xff; zdata[zn++] = a >> 8; zdata[zn++] = a & 0xff;
+	buf_write((void*)sig, 1, 8, b);
+	png_chunk(b, "IHDR", ihdr, 13);
+	png_chunk(b, "IDAT", zdata, zn);
+	png_chunk(b, "IEND", 0, 0);
+	free(raw);
+	free(zdata);
+}
 
-	glDeleteShader(vert_id);
-	glDeleteShader(frag_id);
+#if __linux || __APPLE__
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 
-	return prog;
+static int send_all(int fd, const char* p, size_t n) {
+	while(n) {
+		ssize_t k = send(fd, p, n, MSG_NOSIGNAL);
+		if(k <= 0) return 0;
+		p += k;
+		n -= k;
+	}
+	return 1;
 }
 
-int tile_make(Tile* t){
-	float tx, ty;
-	float* vtx = t->vtx;
-	double scale = pow(2.0, center.zoom - t->z);
-	float ts = (float)(256.0 * scale);
-	crd_t coord = center;
-	crd_zoomto(&coord,t->z);
-	tx = (float)(t->x - coord.column) * ts;
-	ty = (float)(t->y - coord.row) * ts;
+// body paced to mock.rate
+static int mock_send_body(int fd, const char* p, size_t n) {
+	size_t chunk;
+	if(mock.rate <= 0) return send_all(fd, p, n);
+	chunk = maxi(mock.rate * 1024 / 20, 1); // 50 ms worth
+	while(n) {
+		size_t k = mini(n, chunk);
+		if(!send_all(fd, p, k)) return 0;
+		p += k;
+		n -= k;
+		if(n) usleep(50000);
+	}
+	return 1;
+}
 
-	vtx[0] = tx;      vtx[1] = ty;
-	vtx[4] = tx;      vtx[5] = ty + ts;
-	vtx[8] = tx + ts; vtx[9] = ty;
-	vtx[12]= tx + ts; vtx[13]= ty + ts;
+static const char* mock_status(int code) {
+	switch(code) {
+	case 200: return "OK";
+	case 304: return "Not Modified";
+	case 404: return "Not Found";
+	}
+	return "Service Unavailable";
+}
 
-	{
-		int found = 0;
-		float tz = .5f;
-		int xoff = 0, yoff = 0;
-		Tile r,*p;
-		float fx1,fy1,fx2,fy2;
-		int n = 2;
+// answer one request, 0 - close the connection
+static int mock_answer(int fd, char* req) {
+	char path[256], head[256], file[400], etag[40], *inm, *ext; // etag fits three ints
+	const char* ctype = "image/png";
+	int z = 0, x = 0, y = 0, keep = !mock.close, code = 200, n, nodata = 0;
+	Buf* b = buf_get();
+	char* p;
+	if(sscanf(req, "GET %255s", path) != 1) {
+		buf_put(b);
+		return 0;
+	}
+	if(strstr(req, "Connection: close") || strstr(req, "connection: close")) keep = 0;
+	// the last three numbers of the path are z/x/y
+	for(p = path + strlen(path); p > path && p[-1] != '/'; --p);
+	y = atoi(p);
+	if(p > path) for(--p; p > path && p[-1] != '/'; --p);
+	x = atoi(p);
+	if(p > path) for(--p; p > path && p[-1] != '/'; --p);
+	z = atoi(p);
+	etag[0] = 0;
+	if(z >= 0 && z <= 30 && x >= 0 && y >= 0 && x < 1 << z && y < 1 << z) snprintf(etag, sizeof(etag), "\"%d-%d-%d\"", z, x, y);
+	inm = strstr(req, "If-None-Match: ");
+
+	if(mock.latency > 0) usleep(mock.latency * 1000);
+	if(!etag[0]) { // not a tile
+		code = 404;
+	} else if(mock.errors > 0 && rand() % 100 < mock.errors) {
+		code = 503;
+	} else if(inm && strncmp(inm + 15, etag, strlen(etag)) == 0) {
+		code = 304;
+	} else if(mock.dir[0]) {
+		FILE* f;
+		char chunk[16 * 1024];
+		size_t k;
+		ext = strrchr(path, '.');
+		snprintf(file, sizeof(file), "%s/%d/%d/%d%s", mock.dir, z, x, y, ext ? ext : "");
+		if(ext && strcmp(ext, ".png") != 0) ctype = "image/jpeg";
+		if((f = fopen(file, "rb")) == 0) {
+			code = 404;
+		} else {
+			while((k = fread(chunk, 1, sizeof(chunk), f)) > 0) buf_write(chunk, 1, k, b);
+			fclose(f);
+		}
+	} else if(mock.nodata && z > mock.nodata) {
+		mock_png(b, 0, 0, 0);
+		nodata = 1;
+	} else {
+		mock_png(b, z, x, y);
+	}
+	if(code != 200) b->size = 0;
+	n = sprintf(head, "HTTP/1.1 %d %s\r\nContent-Length: %d\r\n", code, mock_status(code), (int)b->size);
+	if(code == 200) n += sprintf(head + n, "Content-Type: %s\r\n", ctype);
+	if(code == 200 || code == 304) n += sprintf(head + n, "ETag: %s\r\n", etag);
+	if(nodata) n += sprintf(head + n, "X-VE-Tile-Info: no-tile\r\n");
+	if(!keep) n += sprintf(head + n, "Connection: close\r\n");
+	strcpy(head + n, "\r\n");
+	if(!send_all(fd, head, strlen(head)) || !mock_send_body(fd, b->data, b->size)) keep = 0;
+	buf_put(b);
+	return keep;
+}
 
-		tile_parent(t, &r);
-		if(r.z == -1) return 0;
-		xoff = t->x & 1;
-		yoff = t->y & 1;
-		p = tile_find(tiles,&r);
-		if(p && p->tex) found = 1;
-		while(!found) {
-			xoff += (r.x & 1) * n;
-			yoff += (r.y & 1) * n;
-			tile_parent(&r, &r);
-			if(r.z == -1) return 0;
-			p = tile_find(tiles, &r);
-			if(p && p->tex) found = 1;
-			tz *= 0.5f;
-			n *= 2;
-		};
-		if (p==0) return 0;
-		t->ptex = p->tex;
-		tx = xoff * tz;
-		ty = yoff * tz;
-		fx1 = tx;
-		fx2 = tx + tz;
-		fy1 = ty;
-		fy2 = ty + tz;
-		vtx[2] = fx1; vtx[3] = fy1;
-		vtx[6] = fx1; vtx[7] = fy2;
-		vtx[10]= fx2; vtx[11]= fy1;
-		vtx[14]= fx2; vtx[15]= fy2;
+static void* worker_mock_conn(void* param) {
+	int fd = (int)(size_t)param, one = 1;
+	char req[4096];
+	size_t n = 0;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	while(1) {
+		char* end;
+		ssize_t k = recv(fd, req + n, sizeof(req) - 1 - n, 0);
+		if(k <= 0) break;
+		n += k;
+		req[n] = 0;
+		while((end = strstr(req, "\r\n\r\n")) != 0) {
+			size_t used = end + 4 - req;
+			end[2] = 0;
+			if(!mock_answer(fd, req)) {
+				close(fd);
+				return 0;
+			}
+			memmove(req, req + used, n - used + 1);
+			n -= used;
+		}
+		if(n == sizeof(req) - 1) break; // header too long
+	}
+	close(fd);
+	return 0;
+}
+
+// listening socket on 127.0.0.1, -1 - failed. Port 0 picks a free one
+// and stores it in mock.port.
+int mock_listen(int port) {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int fd = socket(AF_INET, SOCK_STREAM, 0), one = 1;
+	if(fd < 0) return -1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((unsigned short)port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 1024) != 0) {
+		close(fd);
+		return -1;
+	}
+	getsockname(fd, (struct sockaddr*)&addr, &len);
+	mock.port = ntohs(addr.sin_port);
+	return fd;
+}
+
+// thread per connection, never returns
+void mock_serve(int fd) {
+	while(1) {
+		int c = accept(fd, 0, 0);
+		if(c < 0) continue;
+		StartThread(worker_mock_conn, (size_t)c);
+	}
+}
+#else
+int mock_listen(int port) {
+	(void)port;
+	print("mock server is not supported on this platform\n");
+	return -1;
+}
+
+void mock_serve(int fd) {
+	(void)fd;
+}
+#endif
+
+int serve_main(int argc, char* argv[]) {
+	int fd;
+	mock_options(argc, argv, MOCK_PORT);
+	if((fd = mock_listen(mock.port)) < 0) {
+		print("can't listen on %d\n", mock.port);
 		return 1;
 	}
+	print("serving %s tiles on http://127.0.0.1:%d/z/x/y.png\n", mock.dir[0] ? mock.dir : "generated", mock.port);
+	mock_serve(fd);
+	return 0;
+}
+
+// Seed
+// Headless downloads of tiles before going offline, in batches. Tiles go
+// from the net thread straight to disk, nothing is decoded. A batch is
+// deduplicated and sorted by zoom, then in Z order so neighbours are asked
+// together. Tiles on disk or known to have no imagery are skipped, so a
+// stopped run picks up where it left off.
+#define SEED_QUEUE NET_MAX_TRANSFERS // fetches handed to the net thread at once
+
+typedef struct Seed {
+	unsigned long long* keys; // tile_key, the batch
+	int count;
+	int cap;
+	double total;   // tiles in the job, for the ETA
+	double done;    // tiles of the job finished before this batch
+	double others;  // tiles of the job other processes finished, -shared
+	double others_start; // others when this process began
+	double start;   // ms
+	double shown;   // ms, last progress line
+	int skipped;    // on disk already
+	int failed;     // in this batch
+	void (*beat)(void* arg); // about once a second while a batch runs
+	void* beat_arg;
+} Seed;
+
+mtx_t seed_mtx;
+int seed_ok, seed_nodata, seed_failed, seed_had; // answers, under seed_mtx
+
+void seed_init(Seed* s) {
+	memset(s, 0, sizeof(Seed));
+	s->cap = 4096;
+	s->keys = (unsigned long long*)malloc(s->cap * sizeof(unsigned long long));
+	s->start = s->shown = time_ms();
+	mtx_init(&seed_mtx);
+}
+
+// bits of v apart by one zero
+unsigned long long spread(unsigned int v) {
+	unsigned long long m = v;
+	m = (m | m << 16) & 0x0000ffff0000ffffull;
+	m = (m | m << 8) & 0x00ff00ff00ff00ffull;
+	m = (m | m << 4) & 0x0f0f0f0f0f0f0f0full;
+	m = (m | m << 2) & 0x3333333333333333ull;
+	m = (m | m << 1) & 0x5555555555555555ull;
+	return m;
+}
+
+// x and y bits interleaved
+unsigned long long morton(unsigned int x, unsigned int y) {
+	return spread(x) | spread(y) << 1;
+}
+
+int cmp_key(const void* l, const void* r) {
+	unsigned long long a = *(const unsigned long long*)l, b = *(const unsigned long long*)r;
+	if(a >> 58 != b >> 58) return a >> 58 < b >> 58 ? -1 : 1;
+	a = morton((unsigned int)(a >> 29 & 0x1fffffff), (unsigned int)(a & 0x1fffffff));
+	b = morton((unsigned int)(b >> 29 & 0x1fffffff), (unsigned int)(b & 0x1fffffff));
+	return a < b ? -1 : a > b;
+}
+
+void seed_unique(Seed* s) {
+	int i, n = 0;
+	qsort(s->keys, s->count, sizeof(unsigned long long), cmp_key);
+	for(i = 0; i < s->count; ++i) {
+		if(n == 0 || s->keys[n - 1] != s->keys[i]) s->keys[n++] = s->keys[i];
+	}
+	s->count = n;
+}
+
+void seed_add(Seed* s, int z, int x, int y) {
+	if(x < 0 || y < 0 || x >= 1 << z || y >= 1 << z) return;
+	if(s->count == s->cap) {
+		seed_unique(s);
+		if(s->count > s->cap / 2) {
+			s->cap *= 2;
+			s->keys = (unsigned long long*)realloc(s->keys, s->cap * sizeof(unsigned long long));
+		}
+	}
+	s->keys[s->count++] = tile_key(z, x, y);
+}
+
+// net thread
+void seed_result(int result) {
+	mtx_lock(&seed_mtx);
+	if(result == FETCH_OK) ++seed_ok;
+	else if(result == FETCH_NODATA) ++seed_nodata;
+	else if(result == FETCH_NOT_MODIFIED) ++seed_had;
+	else ++seed_failed;
+	mtx_unlock(&seed_mtx);
+}
+
+int seed_answers() {
+	int n;
+	mtx_lock(&seed_mtx);
+	n = seed_ok + seed_nodata + seed_failed + seed_had;
+	mtx_unlock(&seed_mtx);
+	return n;
+}
+
+// done - tiles this process finished, the rate is of every process on the job
+void seed_progress(Seed* s, double done) {
+	double now = time_ms(), all = done + s->others, rate = (all - s->others_start) * 1000.0 / maxd(now - s->start, 1);
+	double eta = rate > 0 ? (s->total - all) / rate : 0;
+	s->shown = now;
+	print("seed: %.0f of %.0f tiles, %d downloaded, %d failed, %.1f tiles/s, %.1f MB, eta %dh%02dm%02ds\n",
+		all, s->total, seed_ok, seed_failed, rate, net_stats.bytes / (1024 * 1024),
+		(int)(eta / 3600), (int)fmod(eta / 60, 60), (int)fmod(eta, 60));
+}
+
+// one batch, net and writer threads must be running. Returns when every
+// tile of it is on disk, has no data or failed, s->failed counts those.
+void seed_run(Seed* s) {
+	int next = 0, skipped = 0, base = seed_answers(), done = 0, failed = seed_failed, unsaved;
+	mtx_lock(&tiles_save->mtx);
+	unsaved = save_failed;
+	mtx_unlock(&tiles_save->mtx);
+	seed_unique(s);
+	if(s->total < s->done + s->count) s->total = s->done + s->count;
+	while(1) {
+		done = seed_answers() - base;
+		// the provider is down, what is queued would only fail
+		while(next < s->count && next - skipped - done < SEED_QUEUE && !breaker_open(&map.breaker)) {
+			Tile* t = (Tile*)malloc(sizeof(Tile));
+			lru_pin(s->keys[next]); // seeded, spared by the quota
+			key_tile(s->keys[next++], t);
+			if(store.has(t->z, t->x, t->y) || tile_nodata(t)) {
+				free(t);
+				++skipped;
+				continue;
+			}
+			net_fetch(t, NET_LOW, FETCH_PREFETCH | FETCH_SEED);
+		}
+		if(skipped + done == s->count) break;
+		if(time_ms() - s->shown >= 1000) {
+			seed_progress(s, s->done + skipped + done);
+			if(s->beat) s->beat(s->beat_arg);
+		}
+		sleep_ms(20);
+	}
+	save_wait();
+	mtx_lock(&tiles_save->mtx);
+	unsaved = save_failed - unsaved;
+	mtx_unlock(&tiles_save->mtx);
+	mtx_lock(&seed_mtx); // downloaded but not on disk, the block is not done
+	seed_ok -= unsaved;
+	seed_failed += unsaved;
+	mtx_unlock(&seed_mtx);
+	s->done += s->count;
+	s->skipped += skipped;
+	s->failed = seed_failed - failed;
+	s->count = 0;
+}
+
+// 0 - every tile is on disk or has no data
+int seed_report(Seed* s) {
+	print("seed: %.0f tiles, %d were on disk, %d downloaded, %d no data, %d failed in %.0f s\n", s->done,
+		s->skipped + seed_had, seed_ok, seed_nodata, seed_failed, (time_ms() - s->start) / 1000);
+	return seed_failed ? 1 : 0;
+}
+
+// provider from the command line, Bing by default
+void map_select(MapProvider* map, int argc, char* argv[]) {
+	int i;
+	initBingMap(map);
+	for(i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "-o") == 0) initOSMMap(map);
+		else if(strcmp(argv[i], "-y") == 0) initYndexMap(map);
+		else if(strcmp(argv[i], "-b") == 0) initBingMap(map);
+		else if(strcmp(argv[i], "-m") == 0) initMockMap(map, MOCK_PORT);
+	}
+}
+
+// Route
+// The corridor along a GPX track or a plain "lat,lon" per line polyline:
+// every tile within a buffer distance of the route, for a zoom range.
+#define EARTH_CIRCUMFERENCE 40075016.686 // m
+#define MAX_LAT 85.05112878
+
+typedef struct Route {
+	double* pts; // lat, lon
+	int count;
+	int cap;
+} Route;
+
+void route_add(Route* r, double lat, double lon) {
+	if(r->count == r->cap) {
+		r->cap = r->cap ? r->cap * 2 : 256;
+		r->pts = (double*)realloc(r->pts, r->cap * 2 * sizeof(double));
+	}
+	r->pts[r->count * 2] = clampd(lat, -MAX_LAT, MAX_LAT);
+	r->pts[r->count * 2 + 1] = lon;
+	++r->count;
+}
+
+// value of attribute name="..." inside the tag that starts at p
+int gpx_attr(const char* p, const char* name, double* out) {
+	const char* end = strchr(p, '>');
+	size_t len = strlen(name);
+	for(; *p && (!end || p < end); ++p) {
+		if(strncmp(p, name, len) == 0 && p[len] == '=' && (p[len + 1] == '"' || p[len + 1] == '\'')) {
+			*out = atof(p + len + 2);
+			return p[-1] == ' ' || p[-1] == '\t' || p[-1] == '\n' || p[-1] == '\r';
+		}
+	}
 	return 0;
 }
 
-void updateQuads() {
-	int i = 0;
-	for (i=0; i<tiles_draw_count; ++i) {
-		Tile* t = tiles_draw[i];
-		tile_make(t);
+// 0 - no points
+int route_read(const char* path, Route* r) {
+	Buf* b = file_read(path);
+	char* p;
+	memset(r, 0, sizeof(Route));
+	if(!b) return 0;
+	buf_write("", 1, 1, b); // terminate
+	if(strstr(b->data, "<gpx")) {
+		for(p = b->data; (p = strchr(p, '<')) != 0; ++p) {
+			double lat, lon;
+			if(strncmp(p, "<trkpt", 6) != 0 && strncmp(p, "<rtept", 6) != 0) continue;
+			if(gpx_attr(p, "lat", &lat) && gpx_attr(p, "lon", &lon)) route_add(r, lat, lon);
+		}
+	} else {
+		for(p = strtok(b->data, "\r\n"); p; p = strtok(0, "\r\n")) {
+			double lat, lon;
+			if(*p == '#') continue;
+			if(sscanf(p, "%lf%*[ ,;\t]%lf", &lat, &lon) == 2) route_add(r, lat, lon);
+		}
+	}
+	buf_put(b);
+	return r->count > 0;
+}
+
+// squared distance from point p to segment a-b
+double seg_dist2(double px, double py, double ax, double ay, double bx, double by) {
+	double dx = bx - ax, dy = by - ay, len2 = dx * dx + dy * dy, t = 0;
+	if(len2 > 0) t = clampd(((px - ax) * dx + (py - ay) * dy) / len2, 0, 1);
+	dx = ax + t * dx - px;
+	dy = ay + t * dy - py;
+	return dx * dx + dy * dy;
+}
+
+// tiles whose center is within buffer plus half a diagonal of the route,
+// the route is cut into pieces about a tile long to keep the boxes small
+void route_corridor(Route* r, Seed* s, int z0, int z1, double buffer) {
+	int z, i, k, x, y;
+	for(z = z0; z <= z1; ++z) {
+		for(i = 0; i < r->count; ++i) {
+			int j = i + 1 < r->count ? i + 1 : i;
+			double ax = getx(r->pts[i * 2 + 1], z), ay = gety(r->pts[i * 2], z);
+			double bx = getx(r->pts[j * 2 + 1], z), by = gety(r->pts[j * 2], z);
+			double lat = maxd(fabs(r->pts[i * 2]), fabs(r->pts[j * 2]));
+			double rad = buffer * pow(2, z) / (EARTH_CIRCUMFERENCE * cos(lat * pi180)) + M_SQRT1_2;
+			int pieces = maxi(1, (int)ceil(hypot(bx - ax, by - ay)));
+			if(i + 1 == r->count && r->count > 1) break;
+			for(k = 0; k < pieces; ++k) {
+				double px = ax + (bx - ax) * k / pieces, py = ay + (by - ay) * k / pieces;
+				double qx = ax + (bx - ax) * (k + 1) / pieces, qy = ay + (by - ay) * (k + 1) / pieces;
+				for(y = (int)floor(mind(py, qy) - rad); y <= (int)floor(maxd(py, qy) + rad); ++y) {
+					for(x = (int)floor(mind(px, qx) - rad); x <= (int)floor(maxd(px, qx) + rad); ++x) {
+						if(seg_dist2(x + 0.5, y + 0.5, px, py, qx, qy) <= rad * rad) seed_add(s, z, x, y);
+					}
+				}
+			}
+		}
+	}
+}
+
+// "10-16" or "14"
+void zoom_range(const char* arg, int* z0, int* z1) {
+	if(sscanf(arg, "%d-%d", z0, z1) < 2) *z1 = *z0;
+	*z0 = clamp(*z0, 0, 20);
+	*z1 = clamp(*z1, *z0, 20);
+}
+
+int route_main(int argc, char* argv[]) {
+	int i, z0 = 10, z1 = 16;
+	double buffer = 500;
+	Route r;
+	Seed s;
+	if(argc < 2 || argv[1][0] == '-') {
+		print("usage: glutplanet route <track.gpx|points.txt> [-o|-y|-b|-m] [-zoom 10-16] [-buffer m] [provider options]\n");
+		return 1;
+	}
+	for(i = 2; i < argc; ++i) {
+		if(strcmp(argv[i], "-zoom") == 0 && i + 1 < argc) zoom_range(argv[++i], &z0, &z1);
+		else if(strcmp(argv[i], "-buffer") == 0 && i + 1 < argc) buffer = atof(argv[++i]);
+	}
+	if(!route_read(argv[1], &r)) {
+		print("no route points in %s\n", argv[1]);
+		return 1;
+	}
+	map_select(&map, argc, argv);
+	map_options(&map, argc, argv);
+	meta_init(map.name);
+	store_init();
+	if(!store_writable()) {
+		print("another process writes %s/tiles.pack, nothing could be saved\n", map.name);
+		return 1;
+	}
+	save_init();
+	net_init();
+	save_start();
+	StartThread(worker_net, 0);
+
+	seed_init(&s);
+	route_corridor(&r, &s, z0, z1, buffer);
+	seed_unique(&s);
+	print("route: %d points, %d tiles at zoom %d-%d within %.0f m\n", r.count, s.count, z0, z1, buffer);
+	seed_run(&s);
+	return seed_report(&s);
+}
+
+// Bbox
+// glutplanet seed: every tile of a lat/lon box for a zoom range. The box
+// is cut into aligned blocks of SEED_BLOCK x SEED_BLOCK tiles, one batch
+// each, so memory stays flat at any zoom. Finished blocks are appended to
+// a journal, a rerun of the same job skips them without a stat per tile.
+#define SEED_BLOCK_BITS 6
+#define SEED_BLOCK (1 << SEED_BLOCK_BITS)
+
+typedef struct SeedJob {
+	double lat0, lon0, lat1, lon1;
+	int z0, z1;
+	FILE* journal;
+	unsigned long long* blocks; // tile_key of finished blocks, sorted
+	int blocks_count;
+} SeedJob;
+
+// tile range of the box at zoom z
+void bbox_tiles(SeedJob* j, int z, int* x0, int* y0, int* x1, int* y1) {
+	int last = (1 << z) - 1;
+	*x0 = clamp((int)floor(getx(mind(j->lon0, j->lon1), z)), 0, last);
+	*x1 = clamp((int)floor(getx(maxd(j->lon0, j->lon1), z)), 0, last);
+	*y0 = clamp((int)floor(gety(maxd(j->lat0, j->lat1), z)), 0, last);
+	*y1 = clamp((int)floor(gety(mind(j->lat0, j->lat1), z)), 0, last);
+}
+
+// the journal starts with the job and the block size, a different job
+// or a journal cut in other blocks starts it over
+void journal_open(SeedJob* j, const char* path) {
+	char head[128], line[128];
+	int z, x, y, cap = 0;
+	FILE* f;
+	sprintf(head, "seed %.7f %.7f %.7f %.7f %d %d %d\n", j->lat0, j->lon0, j->lat1, j->lon1, j->z0, j->z1, SEED_BLOCK);
+	if((f = fopen(path, "r")) != 0) {
+		if(fgets(line, sizeof(line), f) && strcmp(line, head) == 0) {
+			while(fgets(line, sizeof(line), f)) {
+				if(sscanf(line, "block %d %d %d", &z, &x, &y) != 3) continue;
+				if(j->blocks_count == cap) {
+					cap = cap ? cap * 2 : 256;
+					j->blocks = (unsigned long long*)realloc(j->blocks, cap * sizeof(unsigned long long));
+				}
+				j->blocks[j->blocks_count++] = tile_key(z, x, y);
+			}
+		}
+		fclose(f);
+	}
+	qsort(j->blocks, j->blocks_count, sizeof(unsigned long long), cmp_key);
+	mkpath(path);
+	j->journal = fopen(path, j->blocks_count ? "a" : "w");
+	if(j->journal && !j->blocks_count) fputs(head, j->journal);
+	if(j->blocks_count) print("journal: %d blocks done\n", j->blocks_count);
+}
+
+int journal_has(SeedJob* j, int z, int bx, int by) {
+	unsigned long long key = tile_key(z, bx, by);
+	return bsearch(&key, j->blocks, j->blocks_count, sizeof(unsigned long long), cmp_key) != 0;
+}
+
+// every tile of block bx, by at zoom z that is in the box, 0 - none failed
+int seed_block(SeedJob* j, Seed* s, int z, int bx, int by) {
+	int x0, y0, x1, y1, k;
+	bbox_tiles(j, z, &x0, &y0, &x1, &y1);
+	for(k = 0; k < SEED_BLOCK * SEED_BLOCK; ++k) { // Z order inside the block
+		int x = bx * SEED_BLOCK, y = by * SEED_BLOCK, b;
+		for(b = 0; b < SEED_BLOCK_BITS; ++b) {
+			x += (k >> (2 * b) & 1) << b;
+			y += (k >> (2 * b + 1) & 1) << b;
+		}
+		if(x >= x0 && x <= x1 && y >= y0 && y <= y1) seed_add(s, z, x, y);
+	}
+	if(!s->count) return 0;
+	seed_run(s);
+	return s->failed;
+}
+
+// tiles of the box in block bx, by
+int block_tiles(SeedJob* j, int z, int bx, int by) {
+	int x0, y0, x1, y1, w, h;
+	bbox_tiles(j, z, &x0, &y0, &x1, &y1);
+	w = mini(x1, bx * SEED_BLOCK + SEED_BLOCK - 1) - maxi(x0, bx * SEED_BLOCK) + 1;
+	h = mini(y1, by * SEED_BLOCK + SEED_BLOCK - 1) - maxi(y0, by * SEED_BLOCK) + 1;
+	return w * h;
+}
+
+// all blocks of the job as tile keys, the order every process agrees on
+int job_blocks(SeedJob* j, unsigned long long** out) {
+	int z, bx, by, n = 0, cap = 256;
+	*out = (unsigned long long*)malloc(cap * sizeof(unsigned long long));
+	for(z = j->z0; z <= j->z1; ++z) {
+		int x0, y0, x1, y1;
+		bbox_tiles(j, z, &x0, &y0, &x1, &y1);
+		for(by = y0 / SEED_BLOCK; by <= y1 / SEED_BLOCK; ++by) {
+			for(bx = x0 / SEED_BLOCK; bx <= x1 / SEED_BLOCK; ++bx) {
+				if(n == cap) *out = (unsigned long long*)realloc(*out, (cap *= 2) * sizeof(unsigned long long));
+				(*out)[n++] = tile_key(z, bx, by);
+			}
+		}
 	}
+	return n;
 }
 
-GLuint prog;
-GLuint u_proj;
-
-GLuint prog_alpha;
-GLuint u_alpha;
-GLuint u_tex;
-GLuint u_tex2;
-GLuint u_proj_alpha;
+// Shared job
+// -shared <file>: seeders on one host split a job by block through a
+// mapped file with a state word per block, claimed by compare and swap.
+// A claim holds the owner pid and a heartbeat, one not renewed for
+// SHARED_CLAIM_TTL seconds belongs to a dead seeder and is taken over.
+// Failed blocks are retried by the next seeder that joins.
+#define SHARED_MAGIC "gpseed1"
+#define SHARED_CLAIM_TTL 120 // s
+#define SLOT_FREE   0ull
+#define SLOT_DONE   1ull
+#define SLOT_FAILED 2ull
+#define SLOT_CLAIM(pid) ((unsigned long long)time(0) << 32 | (unsigned int)(pid))
+
+typedef struct SharedJob {
+	char magic[8];    // written last by the process that creates the file
+	double lat0, lon0, lat1, lon1;
+	int z0, z1;
+	int count;        // blocks
+	int pad;
+	volatile unsigned long long slots[1];
+} SharedJob;
+
+typedef struct SharedClaim {
+	SharedJob* job;
+	int slot;
+	unsigned long long value;
+	Seed* seed;
+	int* tiles;  // of each block
+	char* mine;  // blocks this process ran
+} SharedClaim;
 
-void createOrthographicOffCenter(float left, float right, float bottom, float top,
-								 float zNearPlane, float zFarPlane, float* dst) {
-	int i;
-	for (i = 1; i < 13; ++i) dst[i] = 0;
-	dst[0] = 2 / (right - left);
-	dst[5] = 2 / (top - bottom);
-	dst[12] = (left + right) / (left - right);
-	dst[10] = 1 / (zNearPlane - zFarPlane);
-	dst[13] = (top + bottom) / (bottom - top);
-	dst[14] = zNearPlane / (zNearPlane - zFarPlane);
-	dst[15] = 1;
+#if _WIN32
+void* shared_map(const char* path, size_t size, int* created) {
+	HANDLE f, m;
+	void* p;
+	*created = 1;
+	f = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, 0);
+	if(f == INVALID_HANDLE_VALUE) {
+		*created = 0;
+		f = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+		if(f == INVALID_HANDLE_VALUE) return 0;
+	}
+	m = CreateFileMappingA(f, 0, PAGE_READWRITE, 0, (DWORD)size, 0);
+	CloseHandle(f);
+	if(!m) return 0;
+	p = MapViewOfFile(m, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	CloseHandle(m);
+	return p;
+}
+#else
+void* shared_map(const char* path, size_t size, int* created) {
+	void* p;
+	int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+	*created = fd >= 0;
+	if(fd < 0) fd = open(path, O_RDWR);
+	if(fd < 0) return 0;
+	if(*created && ftruncate(fd, (off_t)size) != 0) {
+		close(fd);
+		return 0;
+	}
+	if(!*created) { // the creator may not have sized it yet
+		struct stat st;
+		int tries = 0;
+		while(fstat(fd, &st) == 0 && (size_t)st.st_size < size && tries++ < 500) sleep_ms(10);
+		if((size_t)st.st_size < size) {
+			close(fd);
+			return 0;
+		}
+	}
+	p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	return p == MAP_FAILED ? 0 : p;
 }
+#endif
 
-void reshape(int w, int h) {
-	float m[16];
-	veiwport[0] = w;
-	veiwport[1] = h;
-	glViewport(0, 0, w, h);
-	if (prog){
-		createOrthographicOffCenter(-w/2.f, w/2.f, h/2.f, -h/2.f, -1, 1, m);
-		glUseProgram(prog);
-		glUniformMatrix4fv(u_proj, 1, GL_FALSE, m);
-		glUseProgram(prog_alpha);
-		glUniformMatrix4fv(u_proj_alpha, 1, GL_FALSE, m);
+SharedJob* shared_open(const char* path, SeedJob* j, int count) {
+	size_t size = sizeof(SharedJob) + (count - 1) * sizeof(unsigned long long);
+	int created, tries = 0;
+	SharedJob* s;
+	mkpath(path);
+	if((s = (SharedJob*)shared_map(path, size, &created)) == 0) return 0;
+	if(created) {
+		s->lat0 = j->lat0; s->lon0 = j->lon0; s->lat1 = j->lat1; s->lon1 = j->lon1;
+		s->z0 = j->z0; s->z1 = j->z1;
+		s->count = count;
+		memory_barrier();
+		memcpy(s->magic, SHARED_MAGIC, 8);
+		return s;
+	}
+	while(memcmp((const char*)s->magic, SHARED_MAGIC, 8) != 0 && tries++ < 500) sleep_ms(10);
+	if(memcmp((const char*)s->magic, SHARED_MAGIC, 8) != 0 || s->count != count || s->z0 != j->z0 || s->z1 != j->z1 ||
+		s->lat0 != j->lat0 || s->lon0 != j->lon0 || s->lat1 != j->lat1 || s->lon1 != j->lon1) {
+		print("%s is a different job\n", path);
+		return 0;
 	}
+	return s;
 }
 
-int moffsetx=0;
-int moffsety=0;
-int lastzoom=-1;
-float sm_zoom,t_zoom;
-void mouse(int button, int state, int x, int y) {
-	if (state == GLUT_DOWN) {
-		moffsetx = x;
-		moffsety = y;
+// next block nobody works on, -1 - none left
+int shared_claim(SharedJob* s, int pid, unsigned long long* value) {
+	int i;
+	for(i = 0; i < s->count; ++i) {
+		unsigned long long v = s->slots[i];
+		int stale = v > SLOT_FAILED && time(0) - (time_t)(v >> 32) > SHARED_CLAIM_TTL;
+		if(v != SLOT_FREE && !stale) continue;
+		*value = SLOT_CLAIM(pid);
+		if(cas64(&s->slots[i], v, *value)) return i;
 	}
+	return -1;
+}
 
-	if (button == 3) {
-		t_zoom += 0.1f;
-		sm_zoom = (t_zoom - (float)center.zoom)*0.1f;
-	} else if (button == 4) {
-		t_zoom -= 0.1f;
-		sm_zoom = (t_zoom - (float)center.zoom)*0.1f;
+// tiles of the blocks other processes finished, into the progress line
+void shared_progress(SharedClaim* c) {
+	int i;
+	double n = 0;
+	for(i = 0; i < c->job->count; ++i) {
+		if(c->job->slots[i] == SLOT_DONE && !c->mine[i]) n += c->tiles[i];
 	}
+	c->seed->others = n;
 }
 
-void mousemove(int x,int y) {
-	int ox = moffsetx - x;
-	int oy = moffsety - y;
-	moffsetx = x;
-	moffsety = y;
+// keeps the claim alive while its batch runs
+void shared_beat(void* arg) {
+	SharedClaim* c = (SharedClaim*)arg;
+	unsigned long long v = SLOT_CLAIM(process_id());
+	if(cas64(&c->job->slots[c->slot], c->value, v)) c->value = v;
+	shared_progress(c);
+}
 
-	center.column += ox/256.0;
-	center.row += oy/256.0;
-	make_tiles();
-	updateQuads();
+int shared_done(SharedJob* s) {
+	int i, n = 0;
+	for(i = 0; i < s->count; ++i) n += s->slots[i] == SLOT_DONE;
+	return n;
 }
 
-int tile_make_tex(Tile* t){
-	GLuint textureId;
-	//float* vtx = t->vtx;
-	glGenTextures(1, &textureId);
-	glBindTexture(GL_TEXTURE_2D, textureId);
-	if (t->filename){
-		int w,h,comp;
-		stbi_uc* data = stbi_load(t->filename, &w, &h, &comp, 0);
-		glTexImage2D(GL_TEXTURE_2D, 0, 3, 256, 256, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-		free(data);
-		free(t->filename);
-		t->filename=0;
-	}else{
-		glTexImage2D(GL_TEXTURE_2D, 0, 3/*GL_COMPRESSED_RGB*/, 256, 256, 0, GL_RGB, GL_UNSIGNED_BYTE, t->texdata);
-		//glTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, 256, 256, 0, GL_RGB, GL_UNSIGNED_BYTE, t->texdata);
-		free(t->texdata);
-		t->texdata = 0;
+int seed_shared(SeedJob* j, Seed* s, const char* path) {
+	unsigned long long* blocks;
+	int i, count = job_blocks(j, &blocks), pid = process_id(), mine = 0;
+	SharedClaim c;
+	SharedJob* job = shared_open(path, j, count);
+	if(!job) {
+		print("can't share job %s\n", path);
+		return 1;
 	}
-	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-	t->tex = textureId;
-	//array_push(tiles_blend,t);
-	/*vtx[2] = 0; vtx[3] = 0;
-	vtx[6] = 0; vtx[7] = 1;
-	vtx[10]= 1; vtx[11]= 0;
-	vtx[14]= 1; vtx[15]= 1;*/
-	t->blend = 1.f;
-	return 1;
+	for(i = 0; i < count; ++i) cas64(&job->slots[i], SLOT_FAILED, SLOT_FREE); // one more try
+	print("shared job %s: %d of %d blocks done\n", path, shared_done(job), count);
+	c.job = job;
+	c.seed = s;
+	c.tiles = (int*)malloc(count * sizeof(int));
+	c.mine = (char*)calloc(count, 1);
+	for(i = 0; i < count; ++i) {
+		Tile t;
+		key_tile(blocks[i], &t);
+		c.tiles[i] = block_tiles(j, t.z, t.x, t.y);
+	}
+	shared_progress(&c);
+	s->others_start = s->others;
+	s->beat = shared_beat;
+	s->beat_arg = &c;
+	while((c.slot = shared_claim(job, pid, &c.value)) >= 0) {
+		Tile t;
+		key_tile(blocks[c.slot], &t);
+		++mine;
+		c.mine[c.slot] = 1;
+		// lost the claim to a takeover: the other seeder skips what is on disk
+		cas64(&job->slots[c.slot], c.value, seed_block(j, s, t.z, t.x, t.y) ? SLOT_FAILED : SLOT_DONE);
+		shared_progress(&c);
+	}
+	print("shared job %s: %d of %d blocks done, %d here\n", path, shared_done(job), count, mine);
+	free(c.tiles);
+	free(c.mine);
+	free(blocks);
+	return 0;
 }
-float clck(){
-	return (float)clock();// / CLOCKS_PER_SEC;
+
+int seed_main(int argc, char* argv[]) {
+	SeedJob j;
+	Seed s;
+	char path[96], shared[96];
+	unsigned long long* blocks;
+	int i, count;
+	memset(&j, 0, sizeof(j));
+	j.lat0 = 1000;
+	j.z0 = j.z1 = -1;
+	path[0] = shared[0] = 0;
+	for(i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "-bbox") == 0 && i + 1 < argc) {
+			if(sscanf(argv[++i], "%lf,%lf,%lf,%lf", &j.lat0, &j.lon0, &j.lat1, &j.lon1) != 4) j.lat0 = 1000;
+		}
+		else if(strcmp(argv[i], "-zoom") == 0 && i + 1 < argc) zoom_range(argv[++i], &j.z0, &j.z1);
+		else if(strcmp(argv[i], "-journal") == 0 && i + 1 < argc) snprintf(path, sizeof(path), "%s", argv[++i]);
+		else if(strcmp(argv[i], "-shared") == 0 && i + 1 < argc) snprintf(shared, sizeof(shared), "%s", argv[++i]);
+	}
+	if(j.lat0 == 1000 || j.z0 < 0) {
+		print("usage: glutplanet seed -bbox lat0,lon0,lat1,lon1 -zoom 10-16 [-o|-y|-b|-m] [-journal file | -shared file] [provider options]\n");
+		return 1;
+	}
+	j.lat0 = clampd(j.lat0, -MAX_LAT, MAX_LAT);
+	j.lat1 = clampd(j.lat1, -MAX_LAT, MAX_LAT);
+	map_select(&map, argc, argv);
+	map_options(&map, argc, argv);
+	if(!path[0]) sprintf(path, "%s/seed.journal", map.name);
+	meta_init(map.name);
+	store_init();
+	if(!store_writable()) {
+		print("another process writes %s/tiles.pack, nothing could be saved\n", map.name);
+		return 1;
+	}
+	save_init();
+	net_init();
+	save_start();
+	StartThread(worker_net, 0);
+
+	seed_init(&s);
+	count = job_blocks(&j, &blocks);
+	for(i = 0; i < count; ++i) {
+		Tile t;
+		key_tile(blocks[i], &t);
+		s.total += block_tiles(&j, t.z, t.x, t.y);
+	}
+	print("seed: %.0f tiles at zoom %d-%d\n", s.total, j.z0, j.z1);
+	if(shared[0]) {
+		free(blocks);
+		if(seed_shared(&j, &s, shared)) return 1;
+		return seed_report(&s);
+	}
+	journal_open(&j, path);
+	for(i = 0; i < count; ++i) {
+		Tile t;
+		key_tile(blocks[i], &t);
+		if(journal_has(&j, t.z, t.x, t.y)) {
+			s.done += block_tiles(&j, t.z, t.x, t.y);
+			s.skipped += block_tiles(&j, t.z, t.x, t.y);
+		} else if(seed_block(&j, &s, t.z, t.x, t.y) == 0 && j.journal) {
+			fprintf(j.journal, "block %d %d %d\n", t.z, t.x, t.y);
+			fflush(j.journal);
+		}
+	}
+	if(j.journal) fclose(j.journal);
+	free(blocks);
+	return seed_report(&s);
 }
-#if _WIN32
-static DWORD WINAPI worker_load(void* param){
-#elif __linux || __APPLE__
-static void* worker_load(void* param){
-#endif
-	//size_t n = (size_t)param;
-	while(1){
-		//double start = clck();
-		//print("get %d\n",n);
-		Tile* t = queue_pop_wait(tiles_load);
-		mtx_lock(&tiles_load->mtx);
-		if (!tile_release(t)){
-			void* data;
-			t->ref += 1;
-			mtx_unlock(&tiles_load->mtx);
-			//print("load    %d %.4f\n",n,clck() - start);
-			data = getImageData(t);
-			//print("load ok %d %.4f\n",n,clck() - start);
 
-			mtx_lock(&tiles_load->mtx);
-			if (tile_release(t)){
-				mtx_unlock(&tiles_load->mtx);
-				print("release after load\n");
-				free(data);
-			} else {
-				int sl=0;
-				t->ref += 1;
-				t->texdata = data;
-//				t->download = 0;
-				array_push(tiles_loaded, t);
-				sl = tiles_loaded->count > 10;
-				mtx_unlock(&tiles_load->mtx);
-				while(sl){ // wait signal tiles_loaded->count > 10 without sleep??
-					Sleep(250);
-					mtx_lock(&tiles_load->mtx);
-					sl = tiles_loaded->count > 10;
-					mtx_unlock(&tiles_load->mtx);
-				}
+// glutplanet coverage [-bbox lat0,lon0,lat1,lon1] [-zoom a-b] [-rebuild], what share of the box is cached
+int coverage_main(int argc, char* argv[]) {
+	SeedJob j;
+	int i, z, rebuild = 0, total = 0;
+	memset(&j, 0, sizeof(j));
+	j.lat0 = -MAX_LAT;
+	j.lon0 = -180;
+	j.lat1 = MAX_LAT;
+	j.lon1 = 180;
+	j.z0 = 0;
+	j.z1 = -1;
+	for(i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "-bbox") == 0 && i + 1 < argc) {
+			if(sscanf(argv[++i], "%lf,%lf,%lf,%lf", &j.lat0, &j.lon0, &j.lat1, &j.lon1) != 4) {
+				print("usage: glutplanet coverage [-o|-y|-b|-m] [-bbox lat0,lon0,lat1,lon1] [-zoom 10-16] [-rebuild]\n");
+				return 1;
 			}
-		} else {
-			print("thread release\n");
-			mtx_unlock(&tiles_load->mtx);
+		}
+		else if(strcmp(argv[i], "-zoom") == 0 && i + 1 < argc) zoom_range(argv[++i], &j.z0, &j.z1);
+		else if(strcmp(argv[i], "-rebuild") == 0) rebuild = 1;
+	}
+	j.lat0 = clampd(j.lat0, -MAX_LAT, MAX_LAT);
+	j.lat1 = clampd(j.lat1, -MAX_LAT, MAX_LAT);
+	map_select(&map, argc, argv);
+	map_options(&map, argc, argv);
+	store_init();
+	coverage_init();
+	coverage_build(map.name, rebuild);
+	if(j.z1 < 0) { // up to the deepest zoom cached
+		for(i = 0; i < coverage.cap; ++i) {
+			if(coverage.blocks[i].key) j.z1 = maxi(j.z1, (int)(coverage.blocks[i].key >> 58 & 31));
 		}
 	}
+	for(z = j.z0; z <= j.z1 && z <= 30; ++z) {
+		int x0, y0, x1, y1, n;
+		double all;
+		bbox_tiles(&j, z, &x0, &y0, &x1, &y1);
+		all = ((double)x1 - x0 + 1) * ((double)y1 - y0 + 1);
+		n = coverage_count(z, x0, y0, x1, y1);
+		total += n;
+		print("zoom %2d: %10d of %12.0f tiles, %6.2f%%\n", z, n, all, n * 100.0 / all);
+	}
+	print("%d tiles cached in the box\n", total);
 	return 0;
 }
-int change=0;
 
-void Render(float f){
-    int i=0;//,j=0;
-	//GLuint ltex=-1;
-	
-	Tile* t = array_pop(tiles_loaded);
-	while(t) { // todo while -> for
-		//print("release loaded %p %2d %2d %2d\n", t, t->z, t->x, t->y);
-		if(!tile_release(t)) { // clear unused tiles
-			tile_make_tex(t);
-			change = 1;
-			// slow load in MESA.. TODO: second context
-			if(++i == 1) break; // load by 1 texture or 2 or 5.. directly load only 1 with good cpu
+#if __linux || __APPLE__
+// glutplanet pack: tiles of the TMS layout into the provider pack. The
+// files stay, remove the z directories once the pack is good.
+int pack_main(int argc, char* argv[]) {
+	int i, n = 0, count;
+	double start = time_ms(), bytes = 0;
+	unsigned long long* keys;
+	map_select(&map, argc, argv);
+	map_options(&map, argc, argv);
+	coverage_init();
+	coverage_build(map.name, 1); // crawls the files, the store is not open yet
+	keys = coverage_list(&count);
+	map.store = STORE_PACK;
+	store_init();
+	if(!pack.writer) return 1;
+	for(i = 0; i < count; ++i) {
+		char filename[64];
+		struct stat st;
+		Tile t;
+		Buf* b;
+		key_tile(keys[i], &t);
+		tile_filename(t.z, t.x, t.y, filename);
+		if(stat(filename, &st) != 0 || (b = file_read(filename)) == 0) continue;
+		if(pack_append(keys[i], b->data, b->size, (unsigned int)st.st_mtime)) {
+			bytes += b->size;
+			++n;
 		}
-		t = array_pop(tiles_loaded);
+		buf_put(b);
 	}
+	pack_commit(1);
+	free(keys);
+	print("pack: %d tiles, %.1f MB in %.0f ms\n", n, bytes / (1024 * 1024), time_ms() - start);
+	return 0;
+}
+#else
+int pack_main(int argc, char* argv[]) {
+	(void)argc; (void)argv;
+	print("pack store is not supported on this platform\n");
+	return 1;
+}
+#endif
 
-	if(fabs(center.zoom - t_zoom)>0.001){
-		//print("f: %f zoom: %f center z: %f\n",f,t_zoom,center.zoom);
-		crd_zoomto(&center,center.zoom+sm_zoom);
-		change = 1;
+static int cmp_entry(const void* l, const void* r) {
+	unsigned long long a = ((const ArcEntry*)l)->id, b = ((const ArcEntry*)r)->id;
+	return a < b ? -1 : a > b;
+}
+
+// glutplanet archive out.gpa [-o|-y|-b|-m] [-store ...], the cache of the provider
+int archive_main(int argc, char* argv[]) {
+	ArcHeader h;
+	ArcEntry* e;
+	Buf *b, *leaf = buf_get(), *root = buf_get();
+	unsigned long long* seen; // fnv1a of stored tile bytes, for the same tiles
+	unsigned long long *seen_at, *keys;
+	int i, j, n = 0, unique = 0, cap, leaves = 0, count;
+	double start = time_ms();
+	FILE* f;
+	if(argc < 2 || argv[1][0] == '-') {
+		print("usage: glutplanet archive out.gpa [-o|-y|-b|-m] [-store files|pack|file.mbtiles]\n");
+		return 1;
+	}
+	map_select(&map, argc, argv);
+	map_options(&map, argc, argv);
+	meta_init(map.name);
+	store_init();
+	coverage_init();
+	coverage_build(map.name, 0);
+	if((f = fopen(argv[1], "wb")) == 0) {
+		print("can't write %s\n", argv[1]);
+		return 1;
+	}
+	keys = coverage_list(&count);
+	e = (ArcEntry*)malloc((count + 1) * sizeof(ArcEntry));
+	for(i = 0; i < count; ++i) {
+		Tile t;
+		key_tile(keys[i], &t);
+		e[n++].id = arc_id(t.z, t.x, t.y);
+	}
+	free(keys);
+	qsort(e, n, sizeof(ArcEntry), cmp_entry);
+	for(cap = 1024; cap < n * 2; cap *= 2);
+	seen = (unsigned long long*)calloc(cap, sizeof(unsigned long long));
+	seen_at = (unsigned long long*)calloc(cap, sizeof(unsigned long long));
+
+	memset(&h, 0, sizeof(h));
+	fwrite(&h, sizeof(h), 1, f); // written again at the end
+	for(i = j = 0; i < n; ++i) {
+		Tile t;
+		time_t mtime;
+		unsigned long long hash;
+		int k;
+		arc_tile(e[i].id, &t);
+		if((b = store.get(0, t.z, t.x, t.y, &mtime)) == 0) continue;
+		hash = fnv1a(b->data, b->size) ^ b->size;
+		hash += !hash;
+		for(k = (int)(hash & (cap - 1)); seen[k] && seen[k] != hash; k = (k + 1) & (cap - 1));
+		e[j].id = e[i].id;
+		e[j].len = (unsigned int)b->size;
+		if(seen[k]) e[j].off = seen_at[k];
+		else {
+			e[j].off = sizeof(h) + h.data_len;
+			seen[k] = hash;
+			seen_at[k] = e[j].off;
+			h.data_len += fwrite(b->data, 1, b->size, f);
+			++unique;
+		}
+		++j;
+		buf_put(b);
+	}
+	n = j;
+
+	h.leaves_off = sizeof(h) + h.data_len;
+	varint_put(root, (n + ARC_LEAF - 1) / ARC_LEAF);
+	for(i = 0; i < n; i += ARC_LEAF) {
+		int count = mini(ARC_LEAF, n - i);
+		unsigned long long off = ~0ull;
+		leaf->size = 0;
+		for(j = i; j < i + count; ++j) varint_put(leaf, j > i ? e[j].id - e[j - 1].id : 0);
+		for(j = i; j < i + count; ++j) varint_put(leaf, e[j].len);
+		for(j = i; j < i + count; ++j) {
+			varint_put(leaf, e[j].off == off ? 0 : e[j].off + 1);
+			off = e[j].off + e[j].len;
+		}
+		fwrite(leaf->data, 1, leaf->size, f);
+		varint_put(root, i ? e[i].id - e[i - ARC_LEAF].id : e[i].id);
+		varint_put(root, leaf->size);
+		varint_put(root, count);
+		++leaves;
+	}
+	h.root_off = (unsigned long long)ftell(f);
+	h.root_len = root->size;
+	fwrite(root->data, 1, root->size, f);
+	memcpy(h.magic, ARC_MAGIC, sizeof(ARC_MAGIC));
+	h.tiles = n;
+	fseek(f, 0, SEEK_SET);
+	fwrite(&h, sizeof(h), 1, f);
+	if(fclose(f) != 0) {
+		print("can't write %s\n", argv[1]);
+		return 1;
 	}
+	print("archive: %d tiles, %d stored once, %.1f MB of tiles, %.1f KB of directory in %d leaves, %.0f ms\n",
+		n, unique, h.data_len / (1024.0 * 1024), (h.root_off + h.root_len - h.leaves_off) / 1024.0, leaves, time_ms() - start);
+	return 0;
+}
 
-	if(change) {
-		make_tiles();
-		updateQuads();
-		change = 0;
-		//print("tiles_loaded count: %d\n",tiles_loaded->count);
+// bench
+size_t write_null(void* ptr, size_t size, size_t nmemb, void* userp) {
+	(void)ptr; (void)userp;
+	return size * nmemb;
+}
+
+int bench_get(CURL* curl, const char* url) {
+	long code = 0;
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_null);
+	if(curl_easy_perform(curl) != CURLE_OK) return 0;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+	return code == 200;
+}
+
+// n requests with a new handle per request vs one kept handle
+void bench_curl(const char* url, int n) {
+	int i, fails = 0;
+	double start, fresh, kept;
+	CURL* curl;
+
+	start = time_ms();
+	for(i = 0; i < n; ++i) {
+		curl = curl_easy_init();
+		fails += !bench_get(curl, url);
+		curl_easy_cleanup(curl);
 	}
+	fresh = time_ms() - start;
 
-	glClear(GL_COLOR_BUFFER_BIT);
+	start = time_ms();
+	curl = curl_make_handle();
+	for(i = 0; i < n; ++i) {
+		fails += !bench_get(curl, url);
+	}
+	curl_easy_cleanup(curl);
+	kept = time_ms() - start;
 
-	glEnable(GL_TEXTURE_2D);
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
+	print("%d requests to %s, %d failed\n", n, url, fails);
+	print("new handle:  %8.1f req/s\n", n * 1000.0 / fresh);
+	print("kept handle: %8.1f req/s\n", n * 1000.0 / kept);
+}
 
-	
-	glActiveTexture(GL_TEXTURE0);
-	for (i=0; i<tiles_draw_count; ++i) {
-		Tile* t = tiles_draw[i];
-		if (t->blend > 0 && t->tex) {
-			glUseProgram(prog_alpha);
-			glUniform1f(u_alpha,t->blend);
+#if __linux || __APPLE__
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D,t->ptex);
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D,t->tex);
+double cpu_ms() {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000.0 + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000.0;
+}
 
-			glVertexAttribPointer(0,4,GL_FLOAT,GL_FALSE,0,t->vtx);
-			glVertexAttribPointer(1,2,GL_FLOAT,GL_FALSE,0,texcoord);
+// n tiles from the mock server through net, loaders and decode. The server
+// runs in a child process so the cpu time is ours only.
+int bench_load(int n, int argc, char* argv[]) {
+	int i, z, side, fd, got = 0, failed = 0;
+	double start, cpu, scan = 0, *started, *lat;
+	char filename[64], *done;
+	Tile** all;
+	pid_t pid;
+
+	mock_options(argc, argv, 0); // any free port
+	if((fd = mock_listen(mock.port)) < 0) {
+		print("can't listen on %d\n", mock.port);
+		return 1;
+	}
+	if((pid = fork()) == 0) {
+		mock_serve(fd);
+		_exit(0);
+	}
+	close(fd);
+
+	initMockMap(&map, mock.port);
+	strcpy(map.name, "mock-bench");
+	map.ttl = 0;
+	loaders_count = 3;
+	for(i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "-loaders") == 0 && i + 1 < argc) loaders_count = clamp(atoi(argv[++i]), 1, MAX_LOADERS);
+	}
+	map_options(&map, argc, argv);
+	sprintf(filename, "%s/tiles.meta", map.name);
+	remove(filename); // nothing known from the last run
+	meta_init(map.name);
+	store_init();
 
-			t->blend-=0.0625f;
-			if(t->blend<=0.f) t->blend = 0.f;
-		} else {
-			glUseProgram(prog);
-			glActiveTexture(GL_TEXTURE0);
-			glVertexAttribPointer(0,2,GL_FLOAT,GL_FALSE,16,t->vtx);
-			if (t->tex){
-				glBindTexture(GL_TEXTURE_2D,t->tex);
-				glVertexAttribPointer(1,2,GL_FLOAT,GL_FALSE,0,texcoord);
-			} else {
-				glBindTexture(GL_TEXTURE_2D,t->ptex);
-				glVertexAttribPointer(1,2,GL_FLOAT,GL_FALSE,16,&t->vtx[2]);
-			}
+	tiles_load = make_queue();
+	tiles_loaded = make_array(64);
+	tiles_release = make_array(64);
+	save_init();
+	net_init();
+
+	for(z = 0; (1 << 2 * z) < n; ++z);
+	side = 1 << z;
+	all = (Tile**)malloc(n * sizeof(Tile*));
+	started = (double*)malloc(n * sizeof(double));
+	lat = (double*)malloc(n * sizeof(double));
+	done = (char*)calloc(n, 1);
+	for(i = 0; i < n; ++i) {
+		all[i] = (Tile*)malloc(sizeof(Tile));
+		tile_init(all[i], i % side, i / side, z);
+		all[i]->ref = 1; // ours
+		store.del(z, i % side, i / side); // every tile is downloaded
+	}
+
+	save_start();
+	StartThread(worker_net, 0);
+	readahead_start();
+	for(i = 0; i < loaders_count; ++i) StartThread(worker_load, loader_init(&loaders[i], i));
+
+	cpu = cpu_ms();
+	start = time_ms();
+	for(i = 0; i < n; ++i) {
+		started[i] = time_ms();
+		mtx_lock(&tiles_load->mtx);
+		all[i]->ref += 1;
+		mtx_unlock(&tiles_load->mtx);
+		queue_push_s(tiles_load, all[i]);
+	}
+	while(got + failed < n && time_ms() - start < 300000) {
+		Tile* t;
+		mtx_lock(&tiles_load->mtx);
+		t = array_pop(tiles_loaded);
+		if(t) {
+			free(t->texdata);
+			t->texdata = 0;
+			tile_release(t);
+		}
+		mtx_unlock(&tiles_load->mtx);
+		if(t) {
+			i = t->y * side + t->x;
+			lat[got++] = time_ms() - started[i];
+			done[i] = 1;
+			continue;
+		}
+		usleep(200);
+		if(time_ms() - scan > 50) {
+			scan = time_ms();
+			for(failed = 0, i = 0; i < n; ++i) failed += !done[i] && all[i]->retry_at != 0;
 		}
-		
-		glDrawArrays(GL_TRIANGLE_STRIP,0,4);
 	}
+	start = time_ms() - start;
+	cpu = cpu_ms() - cpu;
+	kill(pid, SIGTERM);
+	waitpid(pid, 0, 0);
+
+	qsort(lat, got, sizeof(double), cmp_double);
+	print("%d tiles, %d failed in %.0f ms, %d loaders\n", got, n - got, start, loaders_count);
+	print("%.1f tiles/s, latency p50 %.1f ms p99 %.1f ms, cpu %.2f ms per tile\n",
+		got * 1000.0 / start, got ? lat[got / 2] : 0, got ? lat[got * 99 / 100] : 0, got ? cpu / got : 0);
+	net_stats_print();
+	return got == n ? 0 : 1;
+}
 
-	tiles_limit();
-
-	glutSwapBuffers();
+static int remove_entry(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+	(void)st; (void)type; (void)ftw;
+	remove(path);
+	return 0;
+}
 
-	// release by 4 tiles
-	for(i=0; i<4 && (t = array_pop(tiles_release)) != 0; ++i){
-		//print("release        %p %2d %2d %2d\n", t, t->z, t->x, t->y);
-		if(t->filename) {
-			free(t->filename);
-			t->filename = 0;
+// a steady drag at zoom 10 from a cold cache, what Render does without GL.
+// Returns how long drawn tiles went without imagery, summed, in ms.
+double bench_pan_run(int frames, int speed) {
+	int i, k;
+	double unloaded = 0, last;
+	Tile* t;
+	nftw(map.name, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+	meta_init(map.name);
+	store_init();
+	tiles = make_queue();
+	tiles_load = make_queue();
+	tiles_loaded = make_array(64);
+	tiles_release = make_array(64);
+	save_init();
+	net_init();
+	save_start();
+	StartThread(worker_net, 0);
+	readahead_start();
+	for(i = 0; i < loaders_count; ++i) StartThread(worker_load, loader_init(&loaders[i], i));
+
+	crd_setz(&center, 0.3, 0.3, 0);
+	crd_zoomto(&center, 10);
+	t_zoom = (float)center.zoom;
+	make_tiles();
+	updateQuads();
+	last = time_ms();
+	for(i = 0; i < frames; ++i) {
+		double now;
+		usleep(16000);
+		now = time_ms();
+		for(k = 0; k < tiles_draw_count; ++k) {
+			if(!tiles_draw[k]->tex) unloaded += now - last;
 		}
-		if(t->texdata) {
+		last = now;
+		mtx_lock(&tiles_load->mtx);
+		while((t = array_pop(tiles_loaded)) != 0) {
+			if(!tile_release(t)) t->tex = 1; // uploaded
 			free(t->texdata);
 			t->texdata = 0;
 		}
-		if(t->tex) {
-			glDeleteTextures(1, &t->tex);
-			t->tex = 0;
+		mtx_unlock(&tiles_load->mtx);
+		view_pan(speed, speed / 2);
+		tiles_idle();
+		tiles_limit();
+		mtx_lock(&tiles_load->mtx);
+		while((t = array_pop(tiles_release)) != 0) {
+			if(t->body) buf_put(t->body);
+			free(t->texdata);
+			free(t);
 		}
-		free(t);
+		mtx_unlock(&tiles_load->mtx);
 	}
+	return unloaded;
 }
 
-void Draw_empty(void){
-    Render(0);
-    glutPostRedisplay();
+// the same drag without and with prefetch, each in its own process
+int bench_pan(int argc, char* argv[]) {
+	int i, fd, run, frames = 300, speed = 12;
+	double unloaded[2] = {0, 0};
+	pid_t server;
+	for(i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "-frames") == 0 && i + 1 < argc) frames = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-speed") == 0 && i + 1 < argc) speed = atoi(argv[++i]);
+	}
+	mock.latency = 150;
+	mock_options(argc, argv, 0);
+	if((fd = mock_listen(mock.port)) < 0) {
+		print("can't listen on %d\n", mock.port);
+		return 1;
+	}
+	if((server = fork()) == 0) {
+		mock_serve(fd);
+		_exit(0);
+	}
+	close(fd);
+	for(run = 0; run < 2; ++run) {
+		int p[2];
+		pid_t pid;
+		if(pipe(p) != 0) break;
+		if((pid = fork()) == 0) {
+			double r;
+			initMockMap(&map, mock.port);
+			strcpy(map.name, "mock-pan");
+			map.ttl = 0;
+			loaders_count = 3;
+			map_options(&map, argc, argv);
+			prefetch_on = run;
+			r = bench_pan_run(frames, speed);
+			if(write(p[1], &r, sizeof(r)) != sizeof(r)) _exit(1);
+			_exit(0);
+		}
+		close(p[1]);
+		if(read(p[0], &unloaded[run], sizeof(double)) != sizeof(double)) unloaded[run] = -1;
+		close(p[0]);
+		waitpid(pid, 0, 0);
+	}
+	kill(server, SIGTERM);
+	waitpid(server, 0, 0);
+	print("%d frames at %d px per frame, %d ms latency\n", frames, speed, mock.latency);
+	print("tiles drawn without imagery: %.1f tile-s, with prefetch %.1f tile-s (%.0f%% less)\n",
+		unloaded[0] / 1000, unloaded[1] / 1000, unloaded[0] > 0 ? 100 * (1 - unloaded[1] / unloaded[0]) : 0);
+	return 0;
 }
 
-/*double p[][2]={
-	{-165.0,60.0},
-	{-165.0+5.0,60.0},
-	{-165.0+5.0,60.0-5.0},
-	{-165.0,60.0-5.0}
-};*/
-
-//55.3992609,-163.1431794
-
-const double pi180 = M_PI / 180.0;
-double getx(double lon, double zoom) {
-	return ((lon + 180) / 360) * pow(2, zoom);
-}
-double gety(double lat, double zoom) {
-	return (1 - log(tan(pi180*lat) + 1 / cos(pi180*lat)) / M_PI) / 2 * pow(2, zoom);
-}
+double disk_bytes;
 
-double getxp(double lon, double pzoom) {
-	return ((lon + 180.0) / 360.0) * pzoom;
-}
-double getyp(double lat, double pzoom) {
-	return (1 - log(tan(pi180*lat) + 1 / cos(pi180*lat)) / M_PI) / 2 * pzoom;
+static int disk_entry(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+	(void)path; (void)ftw;
+	if(type == FTW_F) disk_bytes += (double)st->st_blocks * 512;
+	return 0;
 }
 
-#if _MSC_VER < 1900
-double log2(double Value) {
-	return log(Value) * (1.4426950408889634073599246810019);
+static const char* store_names[] = {"files", "pack", "mbtiles"};
+
+// n tiles of 8 to 24 KB into an empty store, then read back in random
+// order, with the page cache warm. Results: write/s, read/s, MB on disk
+void bench_store_run(int kind, int n, double* out) {
+	int i, side = (int)ceil(sqrt((double)n));
+	int* order = (int*)malloc(n * sizeof(int));
+	Buf* b = buf_get();
+	double start;
+	initMockMap(&map, 0);
+	sprintf(map.name, "bench-%s", store_names[kind]);
+	map.store = kind;
+	sprintf(map.mbtiles, "%s/tiles.mbtiles", map.name);
+	nftw(map.name, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+	mkpath(map.mbtiles);
+	store_init();
+	buf_reserve(b, 24 * 1024);
+	for(i = 0; i < 24 * 1024; ++i) b->data[i] = (char)rand();
+
+	start = time_ms();
+	for(i = 0; i < n; ++i) {
+		b->size = 8 * 1024 + rand() % (16 * 1024);
+		if(!store.put(16, i % side, i / side, b)) print("%s: put failed\n", store_names[kind]);
+	}
+	if(store.sync) store.sync(1);
+	out[0] = n * 1000.0 / (time_ms() - start);
+
+	for(i = 0; i < n; ++i) order[i] = i;
+	for(i = n - 1; i > 0; --i) {
+		int k = rand() % (i + 1), t = order[i];
+		order[i] = order[k];
+		order[k] = t;
+	}
+	start = time_ms();
+	for(i = 0; i < n; ++i) {
+		time_t mtime;
+		Buf* r = store.get(&loaders[0], 16, order[i] % side, order[i] / side, &mtime);
+		if(r) buf_put(r);
+		else print("%s: get failed\n", store_names[kind]);
+	}
+	out[1] = n * 1000.0 / (time_ms() - start);
+	disk_bytes = 0;
+	nftw(map.name, disk_entry, 16, FTW_PHYS);
+	out[2] = disk_bytes / (1024 * 1024);
+	nftw(map.name, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
 }
-#endif
-
-//double lon = -163.1441188, lat = 55.3988969;
-//double lon = -71.06643059, lat = 42.35431920;
-#define NUM_POINTS 4
-double points[NUM_POINTS][3] = {
-	{-163.1441188, 55.3988969, 18.4},
-	{-71.06643059, 42.35431920, 18.4},
-	{139.62034836, -17.53323892, 18.4},
-	{18.41713920, -32.82673124, 18.4}
-};
 
-crd_t fromPointToLatLng(crd_t point, double zoom);
-crd_t fromLatLngToPoint(double lat, double lon, double zoom);
-void keyboard(unsigned char key,int x,int y){
-	if(key == 32) {
-//		double z,rx,ry;
-		crd_t ret;
-		print("row: %.16f column: %.16f zoom: %.16f\n",center.row,center.column,center.zoom);
-		//ret = fromLatLngToPoint(lat,lon, center.zoom);
-		ret = fromPointToLatLng(center, center.zoom);
-		print("lon: %.8f lat: %.8f\n",ret.x,ret.y);
+static const char* durability_names[] = {"none", "batch", "tile"};
+
+// n tiles of 8 to 24 KB through the writers into an empty files store.
+// Results: tiles/s saved, us per save_tile call
+void bench_save_run(int off, int durability, int n, double* out) {
+	int i, side = (int)ceil(sqrt((double)n));
+	Buf* b = buf_get();
+	double start, queued = 0;
+	initMockMap(&map, 0);
+	strcpy(map.name, "bench-save");
+	uring_off = off;
+	save_durability = durability;
+	nftw(map.name, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+	store_init();
+	save_init();
+	save_start();
+	buf_reserve(b, 24 * 1024);
+	for(i = 0; i < 24 * 1024; ++i) b->data[i] = (char)rand();
+	b->size = 24 * 1024;
+	start = time_ms();
+	for(i = 0; i < n; ++i) {
+		Tile t;
+		Buf* c = buf_get();
+		double t0 = time_ms();
+		tile_init(&t, i % side, i / side, 16);
+		buf_write(b->data, 1, 8 * 1024 + rand() % (16 * 1024), c);
+		save_tile(&t, c);
+		queued += time_ms() - t0;
 	}
+	save_wait();
+	out[0] = n * 1000.0 / (time_ms() - start);
+	out[1] = queued * 1000 / n;
+	nftw(map.name, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
 }
 
-/*
-public final class GoogleMapsProjection2 
-{
-private final int TILE_SIZE = 256;
-private PointF _pixelOrigin;
-private double _pixelsPerLonDegree;
-private double _pixelsPerLonRadian;
-
-public GoogleMapsProjection2()
-{
-	this._pixelOrigin = new PointF(TILE_SIZE / 2.0,TILE_SIZE / 2.0);
-	this._pixelsPerLonDegree = TILE_SIZE / 360.0;
-	this._pixelsPerLonRadian = TILE_SIZE / (2 * Math.PI);
+// writer threads and io_uring, every durability, each in its own process
+int bench_save(int n) {
+	int off, durability;
+	for(durability = DURABLE_NONE; durability <= DURABLE_TILE; ++durability) {
+		for(off = 0; off <= 1; ++off) {
+			double out[2] = {0, 0};
+			int p[2];
+			pid_t pid;
+			if(pipe(p) != 0) return 1;
+			if((pid = fork()) == 0) {
+				bench_save_run(off, durability, n, out);
+				if(write(p[1], out, sizeof(out)) != sizeof(out)) _exit(1);
+				_exit(0);
+			}
+			close(p[1]);
+			if(read(p[0], out, sizeof(out)) != sizeof(out)) print("save failed\n");
+			close(p[0]);
+			waitpid(pid, 0, 0);
+			print("%-8s durability %-5s %d tiles: %.0f tiles/s, %.1f us to queue a tile\n",
+				off ? "threads" : "io_uring", durability_names[durability], n, out[0], out[1]);
+		}
+	}
+	return 0;
 }
 
-double bound(double val, double valMin, double valMax)
-{
-	double res;
-	res = Math.max(val, valMin);
-	res = Math.min(res, valMax);
-	return res;
+// every store in its own process
+int bench_store(int n) {
+	int kind;
+	for(kind = STORE_FILES; kind <= STORE_MBTILES; ++kind) {
+		double out[3] = {0, 0, 0};
+		int p[2];
+		pid_t pid;
+		if(pipe(p) != 0) return 1;
+		if((pid = fork()) == 0) {
+			bench_store_run(kind, n, out);
+			if(write(p[1], out, sizeof(out)) != sizeof(out)) _exit(1);
+			_exit(0);
+		}
+		close(p[1]);
+		if(read(p[0], out, sizeof(out)) != sizeof(out)) print("%s: failed\n", store_names[kind]);
+		close(p[0]);
+		waitpid(pid, 0, 0);
+		print("%-7s %d tiles: write %.0f tiles/s, random read %.0f tiles/s, %.1f MB on disk\n",
+			store_names[kind], n, out[0], out[1], out[2]);
+	}
+	return 0;
 }
 
-double degreesToRadians(double deg)
-{
-	return deg * (Math.PI / 180);
+#define AHEAD_ROWS 8 // of the band the bench pans over
+
+// rows x cols mock tiles of zoom 16, row by row like a seed writes them
+void bench_ahead_fill(int kind, int cols) {
+	int x, y;
+	Buf* b = buf_get();
+	initMockMap(&map, 0);
+	sprintf(map.name, "bench-ahead-%s", store_names[kind]);
+	map.store = kind;
+	nftw(map.name, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+	store_init();
+	for(y = 0; y < AHEAD_ROWS; ++y) {
+		for(x = 0; x < cols; ++x) {
+			b->size = 0;
+			mock_png(b, 16, x, y);
+			if(!store.put(16, x, y, b)) print("%s: put failed\n", store_names[kind]);
+		}
+	}
+	if(store.sync) store.sync(1);
+	buf_put(b);
 }
 
-double radiansToDegrees(double rad)
-{
-	return rad / (Math.PI / 180);
+static int drop_entry(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+	int fd;
+	(void)st; (void)ftw;
+	if(type == FTW_F && (fd = open(path, O_RDONLY)) >= 0) {
+#if __linux
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+		close(fd);
+	}
+	return 0;
 }
 
-PointF fromLatLngToPoint(double lat, double lng, int zoom)
-{
-	PointF point = new PointF(0, 0);
-
-	point.x = _pixelOrigin.x + lng * _pixelsPerLonDegree;
-
-	// Truncating to 0.9999 effectively limits latitude to 89.189. This is
-	// about a third of a tile past the edge of the world tile.
-	double siny = bound(Math.sin(degreesToRadians(lat)), -0.9999,0.9999);
-	point.y = _pixelOrigin.y + 0.5 * Math.log((1 + siny) / (1 - siny)) *- _pixelsPerLonRadian;
-
-	int numTiles = 1 << zoom;
-	point.x = point.x * numTiles;
-	point.y = point.y * numTiles;
-	return point;
+// 1 - the kernel dropped its caches, 0 - only the pages of the files under dir
+int drop_caches(const char* dir) {
+	FILE* f;
+	int all = 0;
+	sync();
+	if((f = fopen("/proc/sys/vm/drop_caches", "w")) != 0) {
+		all = fputs("3", f) >= 0;
+		all = fclose(f) == 0 && all;
+	}
+	if(!all) nftw(dir, drop_entry, 16, FTW_PHYS);
+	return all;
 }
 
-PointF fromPointToLatLng(PointF point, int zoom)
-{
-	int numTiles = 1 << zoom;
-	point.x = point.x / numTiles;
-	point.y = point.y / numTiles;
-
-	double lng = (point.x - _pixelOrigin.x) / _pixelsPerLonDegree;
-	double latRadians = (point.y - _pixelOrigin.y) / - _pixelsPerLonRadian;
-	double lat = radiansToDegrees(2 * Math.atan(Math.exp(latRadians)) - Math.PI / 2);
-	return new PointF(lat, lng);
+// the band from bench_ahead_fill through the loaders with cold caches, a
+// column at a time, the way a pan brings tiles in. Results: ms per column,
+// tiles/s, tiles that did not load, caches dropped
+void bench_ahead_run(int kind, int ahead, int cols, double* out) {
+	int i, n = AHEAD_ROWS * cols, got = 0, failed = 0;
+	Tile** all = (Tile**)malloc(n * sizeof(Tile*));
+	double start;
+	initMockMap(&map, 0);
+	sprintf(map.name, "bench-ahead-%s", store_names[kind]);
+	map.store = kind;
+	map.offline = 1;
+	map.ttl = 0;
+	readahead_on = ahead;
+	meta_init(map.name);
+	store_init();
+	tiles_load = make_queue();
+	tiles_loaded = make_array(64);
+	tiles_release = make_array(64);
+	loaders_count = 3;
+	readahead_start();
+	for(i = 0; i < loaders_count; ++i) StartThread(worker_load, loader_init(&loaders[i], i));
+	for(i = 0; i < n; ++i) {
+		all[i] = (Tile*)malloc(sizeof(Tile));
+		tile_init(all[i], i / AHEAD_ROWS, i % AHEAD_ROWS, 16);
+		all[i]->ref = 1; // ours
+	}
+	out[3] = drop_caches(map.name);
+	start = time_ms();
+	for(i = 0; i < n; i += AHEAD_ROWS) {
+		int k, left = AHEAD_ROWS;
+		for(k = i; k < i + AHEAD_ROWS; ++k) {
+			mtx_lock(&tiles_load->mtx);
+			all[k]->ref += 1;
+			mtx_unlock(&tiles_load->mtx);
+			queue_push_s(tiles_load, all[k]);
+		}
+		while(left) {
+			Tile* t;
+			mtx_lock(&tiles_load->mtx);
+			t = array_pop(tiles_loaded);
+			if(t) {
+				free(t->texdata);
+				t->texdata = 0;
+				tile_release(t);
+			}
+			mtx_unlock(&tiles_load->mtx);
+			if(t) {
+				--left;
+				++got;
+				continue;
+			}
+			for(failed = 0, k = i; k < i + AHEAD_ROWS; ++k) failed += all[k]->retry_at != 0;
+			if(failed >= left) break;
+			usleep(100);
+		}
+	}
+	start = time_ms() - start;
+	out[0] = start / cols;
+	out[1] = got * 1000.0 / start;
+	out[2] = n - got;
 }
 
-public static void main(String []args) 
-{
-	GoogleMapsProjection2 gmap2 = new GoogleMapsProjection2();
-
-	PointF point1 = gmap2.fromLatLngToPoint(41.850033, -87.6500523, 15);
-	System.out.println(point1.x+"   "+point1.y);
-	PointF point2 = gmap2.fromPointToLatLng(point1,15);
-	System.out.println(point2.x+"   "+point2.y);
+// without and with readahead for the files and the pack store, each in its own process
+int bench_ahead(int n) {
+	int kind, ahead, cols = maxi(n / AHEAD_ROWS, 2);
+	for(kind = STORE_FILES; kind <= STORE_PACK; ++kind) {
+		pid_t pid;
+		if((pid = fork()) == 0) {
+			bench_ahead_fill(kind, cols);
+			_exit(0);
+		}
+		waitpid(pid, 0, 0);
+		for(ahead = 0; ahead <= 1; ++ahead) {
+			double out[4] = {0, 0, 0, 0};
+			int p[2];
+			if(pipe(p) != 0) return 1;
+			if((pid = fork()) == 0) {
+				bench_ahead_run(kind, ahead, cols, out);
+				if(write(p[1], out, sizeof(out)) != sizeof(out)) _exit(1);
+				_exit(0);
+			}
+			close(p[1]);
+			if(read(p[0], out, sizeof(out)) != sizeof(out)) print("%s: failed\n", store_names[kind]);
+			close(p[0]);
+			waitpid(pid, 0, 0);
+			print("%-5s readahead %-3s %d tiles: %.2f ms per column, %.0f tiles/s, %.0f missing, %s\n",
+				store_names[kind], ahead ? "on" : "off", cols * AHEAD_ROWS, out[0], out[1], out[2],
+				out[3] ? "caches dropped" : "tile pages dropped");
+		}
+		sprintf(map.name, "bench-ahead-%s", store_names[kind]); // the children's, this process has none
+		nftw(map.name, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+	}
+	return 0;
 }
+#else
+int bench_load(int n, int argc, char* argv[]) {
+	(void)n; (void)argc; (void)argv;
+	print("bench load is not supported on this platform\n");
+	return 1;
 }
-*/
-#define TILE_SIZE 256
-double _pixelOrigin[2] = {128.0,128.0};
-double _pixelsPerLonDegree = TILE_SIZE / 360.0;
-double _pixelsPerLonRadian = TILE_SIZE / (2.0 * M_PI);
 
-double bound(double val, double valMin, double valMax){
-	double res;
-	res = maxd(val, valMin);
-	res = mind(res, valMax);
-	return res;
+int bench_pan(int argc, char* argv[]) {
+	(void)argc; (void)argv;
+	print("bench pan is not supported on this platform\n");
+	return 1;
 }
 
-double degreesToRadians(double deg){
-	return deg * pi180;
+int bench_store(int n) {
+	(void)n;
+	print("bench store is not supported on this platform\n");
+	return 1;
 }
 
-double radiansToDegrees(double rad){
-	return rad / pi180;
+int bench_save(int n) {
+	(void)n;
+	print("bench save is not supported on this platform\n");
+	return 1;
 }
 
-crd_t fromLatLngToPoint(double lat, double lon, double zoom){
-	crd_t point;// = new PointF(0, 0);
-	//double siny;
-	double numTiles;
-
-	point.x = getx(lon, zoom);// _pixelOrigin[0] + lon * _pixelsPerLonDegree;
-
-	// Truncating to 0.9999 effectively limits latitude to 89.189. This is
-	// about a third of a tile past the edge of the world tile.
-	//siny = bound(sin(degreesToRadians(lat)), -0.9999,0.9999);
-	//point.y = _pixelOrigin[1] + 0.5 * log((1.0 + siny) / (1.0 - siny)) * -_pixelsPerLonRadian;
-	point.y = gety(lat, zoom);
-
-	numTiles = pow(2,zoom);// 1 << zoom;
-	//point.x = point.x * numTiles;
-	//point.y = point.y * numTiles;
-	point.zoom = zoom;
-	return point;
+int bench_ahead(int n) {
+	(void)n;
+	print("bench ahead is not supported on this platform\n");
+	return 1;
 }
+#endif
 
-crd_t fromPointToLatLng(crd_t point, double zoom){
-	crd_t ret;
-	double lon,latRadians,lat;
-	//int numTiles = 1 << zoom;
-	double numTiles = pow(2, zoom);
-	point.x = point.x / numTiles;
-	point.y = point.y / numTiles;
-
-	lon = (point.y - 0.5/*_pixelOrigin[0]*/) / (1/360.0)/*_pixelsPerLonDegree*/;
-	latRadians = (point.x - 0.5/*_pixelOrigin[1]*/) / -(1/(2.0 * M_PI))/*_pixelsPerLonRadian*/;
-	lat = radiansToDegrees(2 * atan(exp(latRadians)) - M_PI / 2);
-	ret.x = lon;
-	ret.y = lat;
-	ret.zoom = zoom;
-	return ret;
+int bench_main(int argc, char* argv[]) {
+	if(argc > 1 && strcmp(argv[1], "pan") == 0) return bench_pan(argc - 1, argv + 1);
+	if(argc > 1 && strcmp(argv[1], "store") == 0) return bench_store(maxi(argc > 2 ? atoi(argv[2]) : 20000, 1));
+	if(argc > 1 && strcmp(argv[1], "save") == 0) return bench_save(maxi(argc > 2 ? atoi(argv[2]) : 5000, 1));
+	if(argc > 1 && strcmp(argv[1], "ahead") == 0) return bench_ahead(maxi(argc > 2 ? atoi(argv[2]) : 2048, 1));
+	if(argc > 1 && strcmp(argv[1], "load") == 0) {
+		int n = argc > 2 && argv[2][0] != '-' ? atoi(argv[2]) : 1024;
+		return bench_load(maxi(n, 1), argc - 1, argv + 1);
+	}
+	if(argc < 2) {
+		print("usage: glutplanet bench <url> [count]\n");
+		print("       glutplanet bench load [count] [-latency ms] [-bandwidth KB/s] [-errors %%] [-close] [-nodata z] [-dir tiles] [-loaders n]\n");
+		print("       glutplanet bench pan [-frames n] [-speed px] [-latency ms] [mock and provider options]\n");
+		print("       glutplanet bench store [count]\n");
+		print("       glutplanet bench save [count]\n");
+		print("       glutplanet bench ahead [count]\n");
+		return 1;
+	}
+	bench_curl(argv[1], argc > 2 ? atoi(argv[2]) : 200);
+	return 0;
 }
 
-int num_cores(){
-#if _WIN32
-	SYSTEM_INFO sysinfo;
-	GetSystemInfo(&sysinfo);
-	return sysinfo.dwNumberOfProcessors;
-#elif __linux || __APPLE__
-	return sysconf(_SC_NPROCESSORS_ONLN);
-#else
-#error "platform error"
-#endif
-} 
-
 //////////////////////////////////////////////////////////////////////////
 // main
 int main(int argc, char* argv[]) {
@@ -1548,6 +7466,18 @@ int main(int argc, char* argv[]) {
 	crd_t crd;
 	time_t tm;
 	srand((unsigned int)time(&tm));
+	curl_global_init(CURL_GLOBAL_WIN32);
+	share_init();
+	buf_init();
+
+	if(argc > 1 && strcmp(argv[1], "bench") == 0) return bench_main(argc - 1, argv + 1);
+	if(argc > 1 && strcmp(argv[1], "serve") == 0) return serve_main(argc - 1, argv + 1);
+	if(argc > 1 && strcmp(argv[1], "route") == 0) return route_main(argc - 1, argv + 1);
+	if(argc > 1 && strcmp(argv[1], "seed") == 0) return seed_main(argc - 1, argv + 1);
+	if(argc > 1 && strcmp(argv[1], "coverage") == 0) return coverage_main(argc - 1, argv + 1);
+	if(argc > 1 && strcmp(argv[1], "pack") == 0) return pack_main(argc - 1, argv + 1);
+	if(argc > 1 && strcmp(argv[1], "archive") == 0) return archive_main(argc - 1, argv + 1);
+
 	glutInitWindowSize(veiwport[0], veiwport[1]);
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE);
@@ -1558,16 +7488,21 @@ int main(int argc, char* argv[]) {
 	glutReshapeFunc(reshape);
 	glutDisplayFunc(Draw_empty/*draw*/);
 
-	curl_global_init(CURL_GLOBAL_WIN32);
-
 	if(argc>1){
 		if (strcmp(argv[1],"-o")==0) initOSMMap(&map);
 		else if (strcmp(argv[1],"-y")==0) initYndexMap(&map);
 		else if (strcmp(argv[1],"-b")==0) initBingMap(&map);
+		else if (strcmp(argv[1],"-m")==0) initMockMap(&map, MOCK_PORT); // glutplanet serve
 		else initBingMap(&map);
 	} else {
 		initBingMap(&map);
 	}
+	map_options(&map, argc, argv);
+	meta_init(map.name);
+	store_init();
+	coverage_init();
+	if(map.offline) coverage_build(map.name, 0);
+	else StartThread(worker_coverage, 0); // until it is ready every tile is looked for
 
 	//initMqcdnMap(&map);  //not work
 	//initOSMMap(&map);
@@ -1605,8 +7540,13 @@ int main(int argc, char* argv[]) {
 	//tiles_blend = make_array(64);
 	mtx_init(&g_mtx);
 
-	i = 3;// num_cores();
-	while(i--) StartThread(worker_load,(size_t)i);
+	save_init();
+	net_init();
+	save_start();
+	StartThread(worker_net, 0);
+	loaders_count = 3;// num_cores();
+	readahead_start();
+	for(i = 0; i < loaders_count; ++i) StartThread(worker_load, loader_init(&loaders[i], i));
 	
 	make_tiles();
     